@@ -0,0 +1,252 @@
+#include "AnaServer.hh" // Own include
+#include "CutFlow.hh"
+#include "CutOrder.hh"
+#include "Utils.hh"
+#include <TBufferJSON.h>
+#include <TFile.h>
+#include <TSystem.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+/** The trees that can be requested. */
+static const vector<TString> ServeTrees {"Kpi", "K3pi", "MCKpi", "MCK3pi"};
+
+/** The keys of a request, see the README. */
+static const vector<TString> RequestKeys {
+  "tree", "x", "y", "bins", "low", "up", "ybins", "ylow", "yup", "cut", "offline", "title", "format", "out"
+};
+
+/** Longest accepted request, in bytes. */
+static const size_t MaxRequestLength = 65536;
+
+/** Creates a new temporary directory for the spill files. */
+static TString MakeSpillDir()
+{
+  TString dir = TString::Format("%s/ana_serve_%d", gSystem->TempDirectory(), gSystem->GetPid());
+  gSystem->mkdir(dir, true);
+  CHECKA(!gSystem->AccessPathName(dir), dir); // (Returns false if it exists)
+  return dir;
+}
+
+AnaServer::AnaServer(const vector<string>& files, DefineFunc defineColumns, ULong64_t budget)
+: m_files(files), m_defineColumns(defineColumns), m_budget(budget), m_spillDir(MakeSpillDir()),
+  m_canvas(make_unique<PDFCanvas>(m_spillDir + "/scratch.pdf", "cs"))
+{}
+
+AnaServer::~AnaServer()
+{
+  m_dfs.clear();
+  m_caches.clear(); // Removes the spill files
+  m_canvas.reset();
+  gSystem->Unlink(m_spillDir + "/scratch.pdf");
+  gSystem->Unlink(m_spillDir);
+}
+
+SigBkgPlotter::DefineDF& AnaServer::GetDataFrame(TString treeName)
+{
+  auto it = m_dfs.find(treeName);
+  if (it != m_dfs.end()) return it->second;
+  CHECKA(find(ServeTrees.begin(), ServeTrees.end(), treeName) != ServeTrees.end(), "invalid tree " + treeName);
+  auto& cache = m_caches[treeName] = make_unique<ColumnCache>(m_files, treeName, m_spillDir);
+  return m_dfs.emplace(treeName, m_defineColumns(cache->GetDataFrame(), treeName)).first->second;
+}
+
+void AnaServer::Trim(TString recentTree)
+{
+  // The caches of the other trees are trimmed first
+  vector<ColumnCache*> caches;
+  for (const auto& kv : m_caches)
+    if (kv.first != recentTree && kv.first != "MC" + recentTree)
+      caches.push_back(kv.second.get());
+  for (const auto& kv : m_caches)
+    if (kv.first == recentTree || kv.first == "MC" + recentTree)
+      caches.push_back(kv.second.get());
+
+  ULong64_t total = 0;
+  for (ColumnCache* c : caches)
+    total += c->GetResidentBytes();
+  for (ColumnCache* c : caches) {
+    const ULong64_t others = total - c->GetResidentBytes();
+    c->Trim(m_budget > others ? m_budget - others : 0);
+    total = others + c->GetResidentBytes();
+  }
+}
+
+TString AnaServer::Answer(TString request)
+{
+  request = request.Strip(TString::kBoth);
+  if (request == "quit") {
+    m_quit = true;
+    return "OK\n";
+  }
+  if (request == "status") {
+    TString reply = "OK\n";
+    for (const auto& kv : m_caches)
+      reply += kv.second->GetStatus() + "\n";
+    return reply;
+  }
+
+  map<TString,TString> fields;
+  Ssiz_t from = 0;
+  TString field;
+  while (request.Tokenize(field, from, ";")) {
+    const Ssiz_t eq = field.First('=');
+    CHECKA(eq > 0, "invalid field \"" + field + "\"");
+    TString key = field(0, eq), value = field(eq + 1, field.Length() - eq - 1);
+    key = key.Strip(TString::kBoth);
+    value = value.Strip(TString::kBoth);
+    CHECKA(find(RequestKeys.begin(), RequestKeys.end(), key) != RequestKeys.end(), "invalid key " + key);
+    CHECKA(fields.emplace(key, value).second, "repeated key " + key);
+  }
+  TString reply = Book(fields);
+  auto it = fields.find("tree");
+  TString tree = it == fields.end() ? "Kpi" : it->second;
+  Trim(tree.BeginsWith("MC") ? tree.Remove(0, 2) : tree);
+  return reply;
+}
+
+TString AnaServer::Book(const map<TString,TString>& fields)
+{
+  auto field = [&fields](TString key, TString def = "") {
+    auto it = fields.find(key);
+    return it == fields.end() ? def : it->second;
+  };
+  auto number = [&field](TString key, TString def = "") {
+    const TString value = field(key, def);
+    CHECKA(value.IsFloat(), "invalid or missing " + key);
+    return value.Atof();
+  };
+
+  const TString tree = field("tree", "Kpi");
+  const bool isMC = tree.BeginsWith("MC"), isK3pi = tree.EndsWith("K3pi");
+  const TString format = field("format", "json"), out = field("out");
+  CHECKA(format == "json" || format == "root" || format == "pdf", "invalid format " + format);
+  CHECKA(format == "json" || !out.IsNull(), TString("missing out"));
+
+  auto df = GetDataFrame(tree);
+  auto& mcdf = GetDataFrame(isMC ? tree : "MC" + tree);
+  // Expressions become the columns x and y
+  TString x = field("x"), y = field("y");
+  CHECKA(!x.IsNull(), TString("missing x"));
+  if (!df.HasColumn(x.Data())) {
+    df = df.Define("x", x.Data());
+    x = "x";
+  }
+  if (!y.IsNull() && !df.HasColumn(y.Data())) {
+    df = df.Define("y", y.Data());
+    y = "y";
+  }
+  SigBkgPlotter::FilterDF dfCut = df.Filter(field("cut", "true").Data(), "Request");
+  unique_ptr<CutOrderStats> cutStats;
+  ROOT::RDF::RResultPtr<ULong64_t> cutStatsLoop;
+  if (field("offline") == "1") {
+    CHECKA(!isMC, "no offline cuts on " + tree);
+    const auto cuts = GetOfflineCuts(isK3pi);
+    auto order = m_cutOrders.find(tree);
+    if (order != m_cutOrders.end()) {
+      dfCut = ApplyCutsInOrder(dfCut, cuts, order->second);
+    } else { // The first request measures the cuts, the next ones evaluate them in the cheapest order
+      // Sampled before the request cut, so that the order fits the next requests too
+      cutStats = make_unique<CutOrderStats>(cuts, df.GetColumnNames());
+      cutStatsLoop = BookCutOrderStats(df, *cutStats);
+      dfCut = dfCut.Filter(TString::Format("offlineCutsMask == %uu", CutMaskAll(cuts)).Data(), "Offline Cuts");
+    }
+  }
+
+  // On the MC trees, everything is signal
+  const TString chTitle = isK3pi ? "K3#pi" : "K#pi";
+  ResetUniqueNames(); // Same names as in the previous requests
+  SigBkgPlotter plt(dfCut, mcdf, isMC ? "true" : SignalCondition, *m_canvas, tree, isMC ? "MC " + chTitle : chTitle);
+  if (y.IsNull())
+    plt.Histo1D(x, field("title", field("x") + ";" + field("x")), number("bins", "100"), number("low"), number("up"));
+  else
+    plt.Histo2D(x, y, field("title", field("y") + " vs " + field("x") + ";" + field("x") + ";" + field("y")),
+                number("bins", "100"), number("low"), number("up"),
+                number("ybins", "100"), number("ylow"), number("yup"));
+  const auto histos = plt.GetAllHistos(); // Runs the event loop
+  if (cutStats) {
+    m_cutOrders[tree] = cutStats->GetOrder();
+    cout << tree << ": " << cutStats->GetSummary() << endl;
+  }
+
+  TString reply = "OK\n";
+  if (format == "json") {
+    reply += "[";
+    for (size_t i = 0; i < histos.size(); i++)
+      reply += (i == 0 ? "" : ",\n") + TBufferJSON::ConvertToJSON(histos[i], 3);
+    reply += "]\n";
+  } else if (format == "root") {
+    TFile f(out, "recreate");
+    CHECKA(!f.IsZombie(), out);
+    for (TH1* h : histos)
+      f.WriteTObject(h);
+    reply += out + "\n";
+  } else {
+    const TString scratch = m_canvas->GetPDFFileName();
+    m_canvas->SetPDFFileName(out);
+    plt.PrintAll();
+    m_canvas->SetPDFFileName(scratch);
+    reply += out + "\n";
+  }
+  return reply;
+}
+
+void AnaServer::Run(TString socketPath)
+{
+  sockaddr_un addr {};
+  addr.sun_family = AF_UNIX;
+  CHECKA(socketPath.Length() < (Ssiz_t)sizeof(addr.sun_path), "socket path too long: " + socketPath);
+  strcpy(addr.sun_path, socketPath.Data());
+  struct stat st;
+  if (stat(socketPath, &st) == 0) {
+    CHECKA(S_ISSOCK(st.st_mode), socketPath + " exists and is not a socket");
+    unlink(socketPath); // Left by a previous server
+  }
+  const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECKA(server >= 0, TString(strerror(errno)));
+  CHECKA(bind(server, (sockaddr*)&addr, sizeof(addr)) == 0, socketPath + ": " + strerror(errno));
+  CHECKA(listen(server, 8) == 0, socketPath + ": " + strerror(errno));
+  cout << "Listening on " << socketPath << endl;
+
+  m_quit = false;
+  while (!m_quit) {
+    const int client = accept(server, nullptr, nullptr);
+    if (client < 0) {
+      CHECKA(errno == EINTR, TString(strerror(errno)));
+      continue;
+    }
+    // One request (one line) per connection
+    string request;
+    char ch;
+    while (request.size() < MaxRequestLength && read(client, &ch, 1) == 1 && ch != '\n')
+      request += ch;
+    cout << "Request: " << request << endl;
+
+    const auto start = chrono::steady_clock::now();
+    TString reply;
+    try {
+      reply = Answer(request);
+    } catch (const exception& e) {
+      reply = "ERROR "TS + e.what() + "\n";
+    }
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    // The client may be gone already
+    for (Ssiz_t sent = 0; sent < reply.Length();) {
+      const ssize_t n = send(client, reply.Data() + sent, reply.Length() - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(client);
+    cout << TString(reply(0, reply.First('\n'))) << TString::Format(" (%.2f s)", elapsed.count()) << endl;
+  }
+  close(server);
+  unlink(socketPath);
+}
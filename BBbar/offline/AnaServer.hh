@@ -0,0 +1,67 @@
+#pragma once
+#include "ColumnCache.hh"
+#include "Constants.hh"
+#include "PDFCanvas.hh"
+#include "SigBkgPlotter.hh"
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** The resident mode of ana (--serve): the trees are cached in memory
+ * (ColumnCache) and histograms are booked on them on request, from a Unix
+ * socket. Only the first request that uses a column reads it from the
+ * files, and the derived columns are defined once per tree.
+ *
+ * A request is one line of "key=value" fields separated by ";" (see the
+ * README), the reply is "OK" or "ERROR message" followed by the result.
+ */
+class AnaServer {
+ public:
+  /** Defines the derived columns of a tree (e.g. defineVariables). */
+  typedef std::function<SigBkgPlotter::DefineDF(SigBkgPlotter::DefineDF df, TString treeName)> DefineFunc;
+
+  AnaServer() = delete;
+  AnaServer(const AnaServer&) = delete;
+  AnaServer(AnaServer&&) = delete;
+  AnaServer& operator=(const AnaServer&) = delete;
+  AnaServer& operator=(AnaServer&&) = delete;
+
+  /** Nothing is read until the first request.
+   * @param budget Memory for the cached columns of all the trees, in bytes
+   */
+  AnaServer(const std::vector<std::string>& files, DefineFunc defineColumns,
+            ULong64_t budget = ServeCacheBudget * 1048576ull);
+
+  /** Removes the spill directory. */
+  ~AnaServer();
+
+  /** Listens on the Unix socket socketPath and answers the requests, one at a
+   * time, until a "quit" request.
+   */
+  void Run(TString socketPath);
+
+  /** Answers a request, returns the reply. Throws if the request is invalid. */
+  TString Answer(TString request);
+
+ private:
+  /** The cached dataframe of treeName, with the derived columns. */
+  SigBkgPlotter::DefineDF& GetDataFrame(TString treeName);
+
+  /** Trims the caches to the budget, those of recentTree (without "MC") last. */
+  void Trim(TString recentTree);
+
+  /** Books the histogram of a request and returns the reply. */
+  TString Book(const std::map<TString,TString>& fields);
+
+  std::vector<std::string> m_files;
+  DefineFunc m_defineColumns;
+  ULong64_t m_budget;
+  TString m_spillDir;
+  std::unique_ptr<PDFCanvas> m_canvas; /**< Prints to m_spillDir, except during pdf requests. */
+  std::map<TString,std::unique_ptr<ColumnCache>> m_caches;
+  std::map<TString,SigBkgPlotter::DefineDF> m_dfs; /**< Destroyed before the caches. */
+  std::map<TString,std::vector<int>> m_cutOrders; /**< Cheapest order of the offline cuts, by tree. */
+  bool m_quit = false;
+};
@@ -14,6 +14,14 @@ bool ArgParser::HasFlag(TString name)
   return false;
 }
 
+bool ArgParser::HasOption(TString name)
+{
+  for (const TString& option : m_options)
+    if (option == name)
+      return true;
+  return false;
+}
+
 void ArgParser::PrintHelpAndExit(TString progName, bool exitWithError)
 {
   cout << m_desc << endl;
@@ -21,7 +29,12 @@ void ArgParser::PrintHelpAndExit(TString progName, bool exitWithError)
   for (const TString& arg : m_positionalArgs)
     cout << " " << arg;
   for (const TString& arg: m_flags)
-    cout << " " << arg;
+    cout << " [" << arg << "]";
+  for (const TString& arg: m_options) {
+    TString value = arg.Strip(TString::kLeading, '-');
+    value.ToUpper();
+    cout << " [" << arg << " " << value << "]";
+  }
   cout << endl;
   exit(exitWithError ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -44,6 +57,17 @@ map<TString,TString> ArgParser::ParseArgs(int argc, char** argv)
         } else {
           res[arg.Strip(TString::kLeading, '-')] = "";
         }
+      } else if (HasOption(arg)) {
+        TString name = arg.Strip(TString::kLeading, '-');
+        if (res.find(name) != res.end()) {
+          cout << "Repeated option: " << arg << endl;
+          PrintHelpAndExit(progName, true);
+        } else if (i + 1 >= argc) {
+          cout << "Missing value for option: " << arg << endl;
+          PrintHelpAndExit(progName, true);
+        } else {
+          res[name] = argv[++i];
+        }
       } else {
         cout << "Invalid flag: " << arg << endl;
         PrintHelpAndExit(progName, true);
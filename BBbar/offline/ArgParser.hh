@@ -24,9 +24,15 @@ class ArgParser {
    */
   void AddFlag(TString name) { m_flags.push_back(name.BeginsWith("--") ? name : "--" + name); }
 
+  /** Adds an option, which is like a flag but takes a value, given as
+   * "--name value" on the command line. As for flags, "--" can be omitted.
+   */
+  void AddOption(TString name) { m_options.push_back(name.BeginsWith("--") ? name : "--" + name); }
+
   /** Self-explainatory. Returns a map of all the arguments like this:
    *  - Positional arguments: {ARG_NAME: GIVEN_VALUE}
    *  - Flags: {ARG_NAME: ""} if flag is given, not in map otherwise
+   *  - Options: {ARG_NAME: GIVEN_VALUE} if given, not in map otherwise
    *
    * If the number of positional arguments is wrong, or --help is given,
    * prints an help message to stdout and exits.
@@ -36,9 +42,12 @@ class ArgParser {
  private:
   bool HasFlag(TString name);
 
+  bool HasOption(TString name);
+
   void PrintHelpAndExit(TString progName, bool exitWithError);
 
   TString m_desc;
   std::vector<TString> m_positionalArgs;
   std::vector<TString> m_flags;
+  std::vector<TString> m_options;
 };
@@ -0,0 +1,102 @@
+#include "AutoRange.hh" // Own include
+#include "Utils.hh"
+#include <TMath.h>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+/** Widens [low, up] around its center so that its nBins bins have a round
+ * width (1, 1.25, 1.5, 2, ... 8 times a power of 10), with edges at multiples
+ * of the width.
+ */
+static void RoundRange(double& low, double& up, int nBins)
+{
+  const double raw = (up - low) / nBins;
+  const double p = pow(10.0, floor(log10(raw)));
+  for (double m : {1.0, 1.25, 1.5, 2.0, 2.5, 3.0, 4.0, 5.0, 6.0, 8.0, 10.0, 20.0}) {
+    const double w = m * p;
+    if (w < raw) continue;
+    // Centered, the edges at multiples of w
+    double l = floor((low - (nBins * w - (up - low)) / 2) / w) * w;
+    if (l + nBins * w < up) l += w;
+    if (l <= low && l + nBins * w >= up) {
+      low = l;
+      up = l + nBins * w;
+      return;
+    }
+  }
+}
+
+AutoRange::AutoRange(int nBins, double fallbackLow, double fallbackUp, unsigned int nSlots)
+: m_nBins(nBins), m_low(fallbackLow), m_up(fallbackUp), m_slots(nSlots)
+{
+  CHECKA(nBins > 0 && fallbackUp > fallbackLow, TString::Format("%d bins in [%g, %g]", nBins, fallbackLow, fallbackUp));
+}
+
+size_t AutoRange::AddHisto(TString name, TString title)
+{
+  CHECK(!m_fixed);
+  auto h = make_shared<TH1D>(name, title, m_nBins, m_low, m_up);
+  h->SetDirectory(nullptr);
+  m_histos.push_back(h);
+  for (auto& s : m_slots)
+    s.values.emplace_back();
+  return m_histos.size() - 1;
+}
+
+void AutoRange::Decide()
+{
+  if (m_fixed) return;
+  m_fixed = true;
+
+  // The quantiles are order statistics: they do not depend on which slot
+  // had which entry
+  vector<double> values;
+  for (const auto& s : m_slots)
+    for (const auto& v : s.values)
+      for (double x : v)
+        if (TMath::Finite(x))
+          values.push_back(x);
+  if (values.empty()) return;
+  const size_t k = AutoRangeQuantile * (values.size() - 1);
+  nth_element(values.begin(), values.begin() + k, values.end());
+  double low = values[k];
+  nth_element(values.begin(), values.end() - 1 - k, values.end());
+  double up = values[values.size() - 1 - k];
+  if (up <= low) { // A single value (up to the quantiles)
+    const double half = low != 0 ? 0.1 * TMath::Abs(low) : 0.5;
+    low -= half;
+    up += half;
+  }
+  const double margin = AutoRangeMargin * (up - low);
+  m_low = low - margin;
+  m_up = up + margin;
+  RoundRange(m_low, m_up, m_nBins);
+}
+
+void AutoRange::Finalize(size_t i)
+{
+  Decide(); // At the first histogram, with the entries of all of them
+
+  // Merge slots, then sort, so that the statistics of the histogram are
+  // summed in the same order whatever the threads did
+  vector<double> values;
+  for (auto& s : m_slots) {
+    values.insert(values.end(), s.values[i].begin(), s.values[i].end());
+    vector<double>().swap(s.values[i]); // Free the memory as soon as possible
+  }
+  auto nan = partition(values.begin(), values.end(), [](double x) { return !std::isnan(x); });
+  sort(values.begin(), nan);
+
+  TH1D& h = *m_histos[i];
+  h.SetBins(m_nBins, m_low, m_up);
+  for (double x : values)
+    h.Fill(x);
+}
+
+ROOT::RDF::RResultPtr<TH1D> BookAutoRangeHisto(ROOT::RDF::RNode df, shared_ptr<AutoRange> range,
+                                               TString name, TString title, TString column)
+{
+  const size_t i = range->AddHisto(name, title);
+  return df.Book<double>(AutoRangeHistoHelper(range, i), {column.Data()});
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "Constants.hh"
+#include <TH1D.h>
+#include <TString.h>
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RDF/RActionImpl.hxx>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Range shared by 1D histograms filled in the same event loop (e.g. the
+ * signal and background ones of a plot), decided at the end of the loop:
+ * each slot buffers all its entries, then the range is taken from the
+ * AutoRangeQuantile quantiles of the entries of all the slots, widened by
+ * AutoRangeMargin and rounded to round bin widths, and the entries are filled
+ * in the final bins (exact re-bin). The range and the histograms only depend
+ * on the entries, not on how the threads shared them, so two runs on the same
+ * input have the same bins. The buffers take 8 bytes per entry.
+ */
+class AutoRange {
+ public:
+  AutoRange() = delete;
+  AutoRange(const AutoRange&) = delete;
+  AutoRange(AutoRange&&) = delete;
+  AutoRange& operator=(const AutoRange&) = delete;
+  AutoRange& operator=(AutoRange&&) = delete;
+
+  /** @param fallbackLow, fallbackUp The range if there are no finite entries */
+  AutoRange(int nBins, double fallbackLow, double fallbackUp, unsigned int nSlots);
+
+  /** Adds a histogram (before the loop) and returns its index. */
+  size_t AddHisto(TString name, TString title);
+
+  /** The histogram of the given index, filled by Finalize. */
+  std::shared_ptr<TH1D> GetHisto(size_t i) const { return m_histos[i]; }
+
+  /** Called in the event loop (see BookAutoRangeHisto) for histogram i. */
+  void Fill(size_t i, unsigned int slot, double x) { m_slots[slot].values[i].push_back(x); }
+
+  /** Fills histogram i with its entries of all the slots (after the loop). */
+  void Finalize(size_t i);
+
+ private:
+  typedef struct alignas(64) Slot { // Written by one thread
+    std::vector<std::vector<double>> values; /**< The entries of each histogram. */
+  } Slot;
+
+  /** Fixes the range from the entries of all the histograms and slots, if
+   * not done yet.
+   */
+  void Decide();
+
+  int m_nBins;
+  double m_low, m_up; /**< Fallback range, then the fixed one. */
+  std::vector<std::shared_ptr<TH1D>> m_histos;
+  std::vector<Slot> m_slots;
+  bool m_fixed = false;
+};
+
+/** RDataFrame action filling one histogram of an AutoRange (see
+ * BookAutoRangeHisto).
+ */
+class AutoRangeHistoHelper : public ROOT::Detail::RDF::RActionImpl<AutoRangeHistoHelper> {
+ public:
+  using Result_t = TH1D;
+
+  AutoRangeHistoHelper() = delete;
+  AutoRangeHistoHelper(const AutoRangeHistoHelper&) = delete;
+  AutoRangeHistoHelper(AutoRangeHistoHelper&&) = default; // Moved into the action by Book
+  AutoRangeHistoHelper& operator=(const AutoRangeHistoHelper&) = delete;
+  AutoRangeHistoHelper& operator=(AutoRangeHistoHelper&&) = delete;
+
+  AutoRangeHistoHelper(std::shared_ptr<AutoRange> range, size_t index) : m_range(range), m_index(index) {}
+
+  std::shared_ptr<TH1D> GetResultPtr() const { return m_range->GetHisto(m_index); }
+  void Initialize() {}
+  void InitTask(TTreeReader*, unsigned int) {}
+  void Exec(unsigned int slot, double x) { m_range->Fill(m_index, slot, x); }
+  void Finalize() { m_range->Finalize(m_index); }
+  std::string GetActionName() const { return "AutoRangeHisto"; }
+
+ private:
+  std::shared_ptr<AutoRange> m_range;
+  size_t m_index;
+};
+
+/** Books a histogram of the double column of df, with the bins of range
+ * (lazy, like Histo1D).
+ */
+ROOT::RDF::RResultPtr<TH1D> BookAutoRangeHisto(ROOT::RDF::RNode df, std::shared_ptr<AutoRange> range,
+                                               TString name, TString title, TString column);
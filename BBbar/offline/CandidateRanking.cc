@@ -0,0 +1,69 @@
+#include "CandidateRanking.hh" // Own include
+#include <TMath.h>
+using namespace std;
+
+void CandidateRanker::Accumulate(UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand,
+                                 bool sig, const ROOT::RVec<double>& values)
+{
+  auto& ranks = m_slots[iSlot][EvtID(exp, run, evt)];
+  if (ranks.empty()) ranks.resize(m_strategies.size());
+  for (size_t i = 0; i < m_strategies.size(); i++)
+    Insert(ranks[i], {values[i], cand, sig}, m_strategies[i].highest);
+}
+
+void CandidateRanker::Finalize()
+{
+  m_ranks.clear();
+  // Candidates of the same event may have ended up in different slots
+  for (auto& slot : m_slots) {
+    for (const auto& t : slot) {
+      auto& ranks = m_ranks[t.first];
+      if (ranks.empty()) ranks.resize(m_strategies.size());
+      for (size_t i = 0; i < m_strategies.size(); i++)
+        for (const auto& rc : t.second[i])
+          Insert(ranks[i], rc, m_strategies[i].highest);
+    }
+    slot.clear();
+  }
+}
+
+int CandidateRanker::GetRank(size_t i, Int_t exp, Int_t run, Int_t evt, Int_t cand) const
+{
+  auto it = m_ranks.find(EvtID(exp, run, evt));
+  if (it == m_ranks.end()) return BCMaxRank + 1;
+  const auto& top = it->second[i];
+  for (size_t r = 0; r < top.size(); r++)
+    if (top[r].cand == cand)
+      return r + 1;
+  return BCMaxRank + 1;
+}
+
+tuple<UInt_t,UInt_t> CandidateRanker::GetBestCounts(size_t i) const
+{
+  UInt_t nSig = 0, nBkg = 0;
+  for (const auto& t : m_ranks) {
+    const auto& top = t.second[i];
+    if (top.empty()) continue;
+    if (top.front().sig)
+      nSig++;
+    else
+      nBkg++;
+  }
+  return make_tuple(nSig, nBkg);
+}
+
+void CandidateRanker::Insert(vector<RankedCand>& top, const RankedCand& rc, bool highest)
+{
+  // NaNs are worse than anything, ties are broken by the candidate index
+  auto better = [highest](const RankedCand& a, const RankedCand& b) {
+    const bool aNaN = TMath::IsNaN(a.value), bNaN = TMath::IsNaN(b.value);
+    if (aNaN != bNaN) return bNaN;
+    if (!aNaN && a.value != b.value) return highest ? a.value > b.value : a.value < b.value;
+    return a.cand < b.cand;
+  };
+  auto pos = top.begin();
+  while (pos != top.end() && better(*pos, rc)) pos++;
+  if (pos - top.begin() >= BCMaxRank) return;
+  top.insert(pos, rc);
+  if ((int)top.size() > BCMaxRank) top.pop_back();
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "Constants.hh"
+#include "CutEfficiency.hh" // For EvtID
+#include "JitCache.hh"
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <tuple>
+#include <vector>
+#include <map>
+
+/** Ranks the candidates of each event with several strategies at once.
+ * For each strategy, only the best BCMaxRank candidates of each event are
+ * kept (event-grouped top-k), so memory is small even with many candidates.
+ */
+class CandidateRanker {
+ public:
+  CandidateRanker() = delete;
+  CandidateRanker(const CandidateRanker&) = delete;
+  CandidateRanker(CandidateRanker&&) = delete;
+  CandidateRanker& operator=(const CandidateRanker&) = delete;
+  CandidateRanker& operator=(CandidateRanker&&) = delete;
+
+  explicit CandidateRanker(const std::vector<RankingStrategy>& strategies, int nSlots = NThreads)
+  : m_strategies(strategies) { m_slots.resize(nSlots); }
+
+  /** Called in the event loop (see BookRanking) with the slot and columns =
+   * {"__experiment__", "__run__", "__event__", "__candidate__", "isSignal", "values"}
+   * where values has one element per strategy.
+   */
+  void Accumulate(UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand,
+                  bool sig, const ROOT::RVec<double>& values);
+
+  /** Merges the slots. Must be called after the event loop, before GetRank. */
+  void Finalize();
+
+  /** Returns the rank (1 = best) of a candidate according to the i-th
+   * strategy, or BCMaxRank + 1 if it is not among the best BCMaxRank.
+   * Thread safe (after Finalize).
+   */
+  int GetRank(size_t i, Int_t exp, Int_t run, Int_t evt, Int_t cand) const;
+
+  /** Returns the number of events whose best candidate according to the
+   * i-th strategy is signal and background.
+   */
+  std::tuple<UInt_t,UInt_t> GetBestCounts(size_t i) const;
+
+  const std::vector<RankingStrategy>& GetStrategies() const { return m_strategies; }
+
+ private:
+  typedef struct RankedCand { double value; Int_t cand; bool sig; } RankedCand;
+  typedef std::vector<std::vector<RankedCand>> EvtRanks; /**< Best candidates, per strategy. */
+  typedef std::map<EvtID,EvtRanks> table_t;
+
+  /** Inserts rc in top (sorted, best first), keeping at most BCMaxRank elements. */
+  static void Insert(std::vector<RankedCand>& top, const RankedCand& rc, bool highest);
+
+  std::vector<RankingStrategy> m_strategies;
+  std::vector<table_t> m_slots;
+  table_t m_ranks; /**< Merged slots. */
+};
+
+/** Books the ranking of the candidates of df with all the strategies of
+ * ranker: ranker is filled by the next event loop (lazy), whose entries are
+ * counted by the returned result (e.g. for RunGraphs). Then call
+ * ranker.Finalize() and DefineRanks.
+ */
+template <class T>
+ROOT::RDF::RResultPtr<ULong64_t> BookRanking(ROOT::RDF::RInterface<T,void>& df, CandidateRanker& ranker)
+{
+  TString valuesExpr = "ROOT::RVec<double>{";
+  for (const auto& s : ranker.GetStrategies())
+    valuesExpr += (valuesExpr.EndsWith("{") ? "double(" : ", double(") + s.expression + ")";
+  valuesExpr += "}";
+  TString sigExpr = TString::Format("(%s) ? 1.0 : 0.0", SignalCondition.Data());
+
+  return CachedDefine(CachedDefine(df, "rankingtmpSig", sigExpr), "rankingtmpValues", valuesExpr).Filter(
+    [&ranker](UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand,
+              double sig, const ROOT::RVec<double>& values) {
+      ranker.Accumulate(iSlot, exp, run, evt, cand, sig == 1.0, values);
+      return true;
+    }, {"rdfslot_", "__experiment__", "__run__", "__event__", "__candidate__", "rankingtmpSig", "rankingtmpValues"})
+    .Count();
+}
+
+/** Returns df with a "<strategy name>_rank" column for each strategy of
+ * ranker (after the ranking loop and ranker.Finalize()).
+ */
+template <class T>
+ROOT::RDF::RInterface<T,void> DefineRanks(ROOT::RDF::RInterface<T,void>& df, CandidateRanker& ranker)
+{
+  auto res = df;
+  for (size_t i = 0; i < ranker.GetStrategies().size(); i++) {
+    TString col = ranker.GetStrategies()[i].name + "_rank";
+    res = res.Define(col.Data(), [&ranker, i](Int_t exp, Int_t run, Int_t evt, Int_t cand) {
+      return ranker.GetRank(i, exp, run, evt, cand);
+    }, {"__experiment__", "__run__", "__event__", "__candidate__"});
+  }
+  return res;
+}
+
+/** Ranks the candidates of df with all the strategies of ranker in a single
+ * event loop, then returns df with a "<strategy name>_rank" column for each
+ * strategy. This is an instant action and will trigger data processing.
+ */
+template <class T>
+ROOT::RDF::RInterface<T,void> RankCandidates(ROOT::RDF::RInterface<T,void>& df, CandidateRanker& ranker)
+{
+  BookRanking(df, ranker).GetValue();
+  ranker.Finalize();
+  return DefineRanks(df, ranker);
+}
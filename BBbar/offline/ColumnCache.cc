@@ -0,0 +1,132 @@
+#include "ColumnCache.hh" // Own include
+#include "Utils.hh"
+#include <TLeaf.h>
+#include <TSystem.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+
+/** Adds files to chain and returns its number of entries. */
+static ULong64_t AddFiles(TChain& chain, const vector<string>& files)
+{
+  for (const auto& file : files)
+    CHECKA(chain.Add(file.c_str(), 0) > 0, file + ":" + chain.GetName() + " (RNTuples are not supported)");
+  return chain.GetEntries();
+}
+
+/** Reads the branch name of chain as T into data. */
+template <class T>
+static void ReadBranch(TChain& chain, const TString& name, vector<double>& data)
+{
+  TTreeReader reader(&chain);
+  TTreeReaderValue<T> value(reader, name);
+  while (reader.Next())
+    data.push_back(*value);
+  CHECKA(reader.GetEntryStatus() == TTreeReader::kEntryBeyondEnd, name);
+}
+
+ColumnCache::ColumnCache(const vector<string>& files, TString treeName, TString spillDir)
+: m_treeName(treeName), m_spillDir(spillDir), m_chain(treeName),
+  m_nEntries(AddFiles(m_chain, files)), m_rdf(m_nEntries), m_df(m_rdf)
+{
+  // Loads happen inside the event loops of the cached dataframe, with the
+  // mutex held: the reads must not spawn tasks that could run the loop
+  m_chain.SetImplicitMT(false);
+  CHECKA(m_chain.LoadTree(0) >= 0, treeName);
+
+  for (TObject* obj : *m_chain.GetListOfLeaves()) {
+    TLeaf* leaf = (TLeaf*)obj;
+    const TString type = leaf->GetTypeName();
+    if (leaf->GetLenStatic() != 1 || leaf->GetLeafCount()) continue;
+    if (type != "Double_t" && type != "Float_t" && type != "Int_t") continue;
+    m_columns.push_back(make_unique<Column>());
+    Column* c = m_columns.back().get();
+    c->name = leaf->GetBranch()->GetName();
+    c->type = type;
+    // The empty source has the same entry numbers as the files
+    if (c->type == "Int_t")
+      m_df = m_df.Define(c->name.Data(), [this, c](ULong64_t e) { return int(Acquire(*c)[e]); }, {"rdfentry_"});
+    else
+      m_df = m_df.Define(c->name.Data(), [this, c](ULong64_t e) { return Acquire(*c)[e]; }, {"rdfentry_"});
+  }
+}
+
+ColumnCache::~ColumnCache()
+{
+  for (const auto& c : m_columns)
+    if (c->spilled)
+      gSystem->Unlink(SpillFileName(*c));
+}
+
+TString ColumnCache::SpillFileName(const Column& c) const
+{
+  return m_spillDir + "/" + m_treeName + "." + c.name + ".bin";
+}
+
+void ColumnCache::Load(Column& c)
+{
+  lock_guard<mutex> lock(m_mutex);
+  if (c.resident.load(memory_order_relaxed)) return; // Loaded by another thread
+  c.data.clear();
+  c.data.reserve(m_nEntries);
+  if (c.spilled) {
+    FILE* f = fopen(SpillFileName(c), "rb");
+    CHECKA(f, SpillFileName(c));
+    c.data.resize(m_nEntries);
+    const size_t n = fread(c.data.data(), sizeof(double), m_nEntries, f);
+    fclose(f);
+    CHECKA(n == m_nEntries, SpillFileName(c));
+  } else {
+    if (c.type == "Int_t")
+      ReadBranch<Int_t>(m_chain, c.name, c.data);
+    else if (c.type == "Float_t")
+      ReadBranch<Float_t>(m_chain, c.name, c.data);
+    else
+      ReadBranch<Double_t>(m_chain, c.name, c.data);
+    CHECKA(c.data.size() == m_nEntries, c.name);
+  }
+  m_residentBytes += m_nEntries * sizeof(double);
+  c.resident.store(true, memory_order_release);
+}
+
+void ColumnCache::Trim(ULong64_t budget)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_clock++;
+  vector<Column*> resident;
+  for (const auto& c : m_columns) {
+    if (c->touched.exchange(false, memory_order_relaxed))
+      c->lastUse = m_clock;
+    if (c->resident.load(memory_order_relaxed))
+      resident.push_back(c.get());
+  }
+  sort(resident.begin(), resident.end(), [](Column* a, Column* b) { return a->lastUse < b->lastUse; });
+
+  for (Column* c : resident) {
+    if (m_residentBytes <= budget) break;
+    if (!c->spilled) { // The data never change, once spilled it is for good
+      FILE* f = fopen(SpillFileName(*c), "wb");
+      CHECKA(f, SpillFileName(*c));
+      const size_t n = fwrite(c->data.data(), sizeof(double), c->data.size(), f);
+      CHECKA(fclose(f) == 0 && n == c->data.size(), SpillFileName(*c));
+      c->spilled = true;
+    }
+    c->resident.store(false, memory_order_relaxed);
+    vector<double>().swap(c->data);
+    m_residentBytes -= m_nEntries * sizeof(double);
+  }
+}
+
+TString ColumnCache::GetStatus() const
+{
+  int nResident = 0, nSpilled = 0;
+  for (const auto& c : m_columns) {
+    if (c->resident) nResident++;
+    else if (c->spilled) nSpilled++;
+  }
+  return TString::Format("%s: %llu entries, %d/%zu columns in memory (%.0f MB), %d spilled",
+                         m_treeName.Data(), m_nEntries, nResident, m_columns.size(),
+                         m_residentBytes / 1048576.0, nSpilled);
+}
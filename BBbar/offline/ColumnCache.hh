@@ -0,0 +1,83 @@
+#pragma once
+#include "SigBkgPlotter.hh"
+#include <TChain.h>
+#include <ROOT/RDataFrame.hxx>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** In-memory copy of the columns of a tree (TTree only), for ana --serve.
+ * Each column is read from the files the first time an event loop uses it,
+ * then kept in memory as doubles. Beyond a memory budget (see Trim), the
+ * least recently used columns are spilled to raw files in spillDir, which
+ * are much faster to read back than the ROOT files.
+ */
+class ColumnCache {
+ public:
+  ColumnCache() = delete;
+  ColumnCache(const ColumnCache&) = delete;
+  ColumnCache(ColumnCache&&) = delete;
+  ColumnCache& operator=(const ColumnCache&) = delete;
+  ColumnCache& operator=(ColumnCache&&) = delete;
+
+  /** Opens treeName in files. Nothing is read yet. */
+  ColumnCache(const std::vector<std::string>& files, TString treeName, TString spillDir);
+
+  /** Removes the spill files. */
+  ~ColumnCache();
+
+  /** A dataframe on the cached entries, with a column for each Double_t,
+   * Float_t and Int_t branch of the tree. Valid as long as the cache.
+   */
+  SigBkgPlotter::DefineDF GetDataFrame() { return m_df; }
+
+  /** Spills the least recently used columns until the resident ones fit in
+   * budget bytes. Not during an event loop.
+   */
+  void Trim(ULong64_t budget);
+
+  /** Bytes of the columns in memory. */
+  ULong64_t GetResidentBytes() const { return m_residentBytes; }
+
+  /** One line with the number of columns in memory and spilled. */
+  TString GetStatus() const;
+
+ private:
+  typedef struct Column {
+    TString name;
+    TString type; /**< Of the branch: Double_t, Float_t or Int_t. */
+    std::vector<double> data;
+    std::atomic<bool> resident {false};
+    std::atomic<bool> touched {false}; /**< Used since the last Trim. */
+    bool spilled = false;              /**< A spill file exists. */
+    ULong64_t lastUse = 0;             /**< Trim "time" of the last use. */
+  } Column;
+
+  /** Returns the data of c, loading them if they are not in memory. */
+  const double* Acquire(Column& c)
+  {
+    if (!c.touched.load(std::memory_order_relaxed))
+      c.touched.store(true, std::memory_order_relaxed);
+    if (!c.resident.load(std::memory_order_acquire))
+      Load(c);
+    return c.data.data();
+  }
+
+  /** Reads c from the spill file or from the files. */
+  void Load(Column& c);
+
+  TString SpillFileName(const Column& c) const;
+
+  TString m_treeName;
+  TString m_spillDir;
+  TChain m_chain;
+  ULong64_t m_nEntries;
+  std::vector<std::unique_ptr<Column>> m_columns;
+  std::mutex m_mutex; /**< Held while loading. */
+  std::atomic<ULong64_t> m_residentBytes {0};
+  ULong64_t m_clock = 0; /**< Number of Trim calls. */
+  ROOT::RDataFrame m_rdf;
+  SigBkgPlotter::DefineDF m_df;
+};
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Wrapper for CompareEfficiency.C (compiled with ACLiC)
+# Usage ./CompareEfficiency.sh file1.root file2.root [report.tsv] [threshold]
+# Exits with 1 if some histograms differ (p-value < threshold, default 1e-3),
+# 2 if the comparison failed
+scriptdir="$(dirname "$0")"
+macro="${scriptdir%/}/CompareEfficiency.C"
+report="${3:-compare_report.tsv}"
+threshold="${4:-1e-3}"
+rm -f "$report"
+root -l -b -q -e "gROOT->LoadMacro(\"$macro+\")" \
+     -e "gSystem->Exit(CompareEfficiency(\"$1\", \"$2\", \"$report\", $threshold) > 0 ? 1 : 0)"
+status=$?
+# An exception does not reach gSystem->Exit
+[ ! -f "$report" ] && exit 2
+exit $status
@@ -1,4 +1,5 @@
 #include "Constants.hh" // Own include
+#include <TMath.h>
 
 // B0_isSignalAcceptMissingNeutrino is 1.0 only if the whole decay tree is
 // correctly reconstructed. It can be 0.0 or NaN (!!!) otherwise.
@@ -9,21 +10,137 @@ const TString SignalCondition = "B0_isSignalAcceptMissingNeutrino == 1.0";
 // M_D0 = 1.86484
 // ΔM   = 0.145426
 
-const TString CommonCuts =
-  "TMath::Abs(Dst_M_preFit-2.01026) < 0.1"
-  "&& TMath::Abs(D0_M_preFit-1.86484) < 0.1"
-  "&& TMath::Abs(massDiffPreFit-0.145426) < 0.005" // Lower cut is not in steering file (for now)
-  "&& mu_dr < 2 && TMath::Abs(mu_dz) < 2"
-  "&& K_dr < 2 && TMath::Abs(K_dz) < 2"
-  "&& pisoft_dr < 2 && TMath::Abs(pisoft_dz) < 2"
-  "&& mu_nVXDHits > 0 && K_nVXDHits > 0 && pisoft_nVXDHits > 0" // VXD = PXD+SVD+VTX
-  "&& Dst_p_CMS < 2.5"; // From momentum conservation
-
-const TString KpiCuts =
-  "pi_dr < 2 && TMath::Abs(pi_dz) < 2"
-  "&& pi_nVXDHits > 0";
-
-const TString K3piCuts =
-  "pi1_dr < 2 && TMath::Abs(pi1_dz) < 2 && pi1_nVXDHits > 0"
-  "&& pi2_dr < 2 && TMath::Abs(pi2_dz) < 2 && pi2_nVXDHits > 0"
-  "&& pi3_dr < 2 && TMath::Abs(pi3_dz) < 2 && pi3_nVXDHits > 0";
+/// dr, dz and nVXDHits cuts of a track
+static std::vector<OfflineCut> TrackCuts(TString p)
+{
+  const TString t = ParticlesTitles.at(p);
+  return {
+    {p + "_dr", p + "_dr < 2", p + "_dr", "dr_{" + t + "};dr_{" + t + "} [cm]", 100, 0, 4},
+    {p + "_dz", "TMath::Abs(" + p + "_dz) < 2", p + "_dz", "dz_{" + t + "};dz_{" + t + "} [cm]", 100, -4, 4},
+    {p + "_nVXDHits", p + "_nVXDHits > 0", p + "_nVXDHits", // VXD = PXD+SVD+VTX
+     "VXD hits of " + t + ";VXD hits of " + t, 21, -0.5, 20.5}
+  };
+}
+
+template <class T>
+static std::vector<T> operator+(std::vector<T> a, const std::vector<T>& b)
+{
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+static TString JoinCuts(const std::vector<OfflineCut>& cuts)
+{
+  TString res;
+  for (const auto& cut : cuts)
+    res += (res.IsNull() ? "" : " && ") + cut.expression;
+  return res;
+}
+
+const std::vector<OfflineCut> CommonCutsList = std::vector<OfflineCut> {
+  {"Dst_M_preFit", "TMath::Abs(Dst_M_preFit-2.01026) < 0.1", "Dst_M_preFit",
+   "M_{D*} (pre-fit);M_{D*} [GeV/c^{2}]", 110, 1.88, 2.14},
+  {"D0_M_preFit", "TMath::Abs(D0_M_preFit-1.86484) < 0.1", "D0_M_preFit",
+   "M_{D^{0}} (pre-fit);M_{D^{0}} [GeV/c^{2}]", 110, 1.74, 2.0},
+  {"massDiffPreFit", "TMath::Abs(massDiffPreFit-0.145426) < 0.005", "massDiffPreFit", // Lower cut is not in steering file (for now)
+   "#DeltaM (pre-fit);M_{D*} - M_{D^{0}} [GeV/c^{2}]", 110, 0.139, 0.152}
+} + TrackCuts("mu") + TrackCuts("K") + TrackCuts("pisoft") + std::vector<OfflineCut> {
+  {"Dst_p_CMS", "Dst_p_CMS < 2.5", "Dst_p_CMS", // From momentum conservation
+   "p_{CM,D*};p^{CM}_{D*} [GeV/c]", 120, 0, 3}
+};
+
+const std::vector<OfflineCut> KpiCutsList = TrackCuts("pi");
+
+const std::vector<OfflineCut> K3piCutsList = TrackCuts("pi1") + TrackCuts("pi2") + TrackCuts("pi3");
+
+const TString CommonCuts = JoinCuts(CommonCutsList);
+
+const TString KpiCuts = JoinCuts(KpiCutsList);
+
+const TString K3piCuts = JoinCuts(K3piCutsList);
+
+const std::vector<RankingStrategy> BCStrategies {
+  {"BC", "max M_{B^{0}}", "B0_M", true},
+  {"BCChiProb", "max #chi^{2}_{B^{0}}", "B0_chiProb", true},
+  {"BCDstdM", "min |#deltaM_{D*}|", "TMath::Abs(Dst_M-2.01026)", false},
+  {"BCD0dM", "min |#deltaM_{D^{0}}|", "TMath::Abs(D0_M-1.86484)", false},
+  {"BCMassDiff", "min |#delta#DeltaM|", "TMath::Abs(massDiff-0.145426)", false}
+};
+
+// A variation can only apply a subset of the offline cuts, with their
+// thresholds: the other CUTS of mdst2ntuple.py cannot be reproduced, i.e.
+// ndf>0 and conf (not in the ntuples) and the other thresholds, such as the
+// dM windows of "loose"
+const std::vector<Variation> Variations {
+  {"VarLoose", "loose", "", ""},
+  {"VarNormal", "normal", "_(dr|dz|nVXDHits)$|^Dst_p_CMS$", ""}, // Track cuts and p_CM(D*) < 2.5
+  {"VarTight", "tight", ".*", ""},
+  {"VarTightDstSig", "tight, true D* as signal", ".*", "Dst_isSignal == 1.0"}
+};
+
+// Cut scan: dr, dz, p_CM(D*) and the DeltaM window are scanned, the other
+// offline cuts are applied as they are
+const std::vector<CutScanAxis> KpiCutScanAxes {
+  {"dr", "std::max({mu_dr, K_dr, pisoft_dr, pi_dr})", 11, 0.5, 3, true, "_dr$"},
+  {"|dz|", "std::max({TMath::Abs(mu_dz), TMath::Abs(K_dz), TMath::Abs(pisoft_dz), TMath::Abs(pi_dz)})",
+   11, 0.5, 3, true, "_dz$"},
+  {"p_{CM,D*}", "Dst_p_CMS", 11, 2, 3, true, "^Dst_p_CMS$"},
+  {"|#delta#DeltaM|", "TMath::Abs(massDiffPreFit-0.145426)", 11, 0.001, 0.011, true, "^massDiffPreFit$"}
+};
+
+const std::vector<CutScanAxis> K3piCutScanAxes {
+  {"dr", "std::max({mu_dr, K_dr, pisoft_dr, pi1_dr, pi2_dr, pi3_dr})", 11, 0.5, 3, true, "_dr$"},
+  {"|dz|", "std::max({TMath::Abs(mu_dz), TMath::Abs(K_dz), TMath::Abs(pisoft_dz), "
+           "TMath::Abs(pi1_dz), TMath::Abs(pi2_dz), TMath::Abs(pi3_dz)})", 11, 0.5, 3, true, "_dz$"},
+  {"p_{CM,D*}", "Dst_p_CMS", 11, 2, 3, true, "^Dst_p_CMS$"},
+  {"|#delta#DeltaM|", "TMath::Abs(massDiffPreFit-0.145426)", 11, 0.001, 0.011, true, "^massDiffPreFit$"}
+};
+
+const TString JitCacheCompiler = "g++ -O2 -shared -fPIC -w";
+
+const TString SingleGaussian = "[N]*exp(-0.5*((x-[mu])/[sigma])**2)";
+
+const TString DoubleGaussian =
+  "[N1]*exp(-0.5*((x-[mu])/[sigma1])**2) + [N2]*exp(-0.5*((x-[mu])/[sigma2])**2)";
+
+// Resolution maps: (p, theta, phi, first VXD layer) of the track, or of the
+// D0 and of its kaon, then the residual in um. Densely stored, each map would
+// take 30*36*36*7*202 doubles (~450 MB) per slot
+static const std::vector<ResolutionMapAxis> TrackMapAxes {
+  {"p_{$p} [GeV/c]", "$p_mcP", 30, 0, 3},
+  {"#theta_{$p}", "$p_mcTheta", 36, 0, TMath::Pi()},
+  {"#phi_{$p}", "$p_mcPhi", 36, -TMath::Pi(), TMath::Pi()},
+  {"First VXD layer of $p", "$p_firstVXDLayer", 7, -0.5, 6.5}
+};
+
+static const std::vector<ResolutionMapAxis> VertexMapAxes {
+  {"p_{$p} [GeV/c]", "$p_mcP", 35, 0, 3.5},
+  {"#theta_{$p}", "$p_mcTheta", 36, 0, TMath::Pi()},
+  {"#phi_{$p}", "$p_mcPhi", 36, -TMath::Pi(), TMath::Pi()},
+  {"First VXD layer of K", "K_firstVXDLayer", 7, -0.5, 6.5}
+};
+
+const std::vector<ResolutionMapDef> TrackResolutionMaps {
+  {"d0Residual", TrackMapAxes + std::vector<ResolutionMapAxis> {
+     {"d_{0,$p} residual [#mum]", "$p_d0Residual * 1e4", 200, -250, 250}}},
+  {"z0Residual", TrackMapAxes + std::vector<ResolutionMapAxis> {
+     {"z_{0,$p} residual [#mum]", "$p_z0Residual * 1e4", 200, -250, 250}}}
+};
+
+const std::vector<ResolutionMapDef> VertexResolutionMaps {
+  {"residualDecayX", VertexMapAxes + std::vector<ResolutionMapAxis> {
+     {"x_{decay,$p} residual [#mum]", "$p_residualDecayX * 1e4", 200, -250, 250}}},
+  {"residualDecayY", VertexMapAxes + std::vector<ResolutionMapAxis> {
+     {"y_{decay,$p} residual [#mum]", "$p_residualDecayY * 1e4", 200, -250, 250}}},
+  {"residualDecayZ", VertexMapAxes + std::vector<ResolutionMapAxis> {
+     {"z_{decay,$p} residual [#mum]", "$p_residualDecayZ * 1e4", 200, -250, 250}}}
+};
+
+const std::vector<TString> ExportParticleVariables {
+  "p", "pt", "theta", "phi", "dr", "dz", "nVXDHits", "d0Residual", "z0Residual", "pResidual"
+};
+
+const std::vector<TString> ExportEventVariables {
+  "B0_M", "B0_chiProb", "Dst_M", "D0_M", "massDiff", "massDiffPreFit", "Dst_p_CMS",
+  "D0_flightDistance", "D0_residualDecayX", "D0_residualDecayY", "D0_residualDecayZ", "__ncandidates__"
+};
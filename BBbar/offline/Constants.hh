@@ -1,62 +1,214 @@
 #pragma once
 #include <TColor.h>
+#include "DecayChain.hh"
 #include <TString.h>
 #include <map>
+#include <vector>
 
 const int NThreads = 8;
 
+/// Seconds between two scans of the input directory in watch mode
+const int WatchInterval = 60;
+
+/// Files modified less than this number of seconds ago are ignored in watch mode
+const int WatchSettleTime = 120;
+
+/// Memory for the columns cached by ana --serve, in MB: beyond it, the least
+/// recently used columns are spilled to the temporary directory
+const int ServeCacheBudget = 8192;
+
+/// Initial size of the event lists of SigBkgPlotter::PurityH1D (one per
+/// particle and plotter), reduced by --mem-budget if needed
+const size_t PurityReserve = 10000000;
+
+/// First fraction of the events tried by --target-precision
+const double PreviewStartFraction = 0.02;
+
+/// Entries needed in a bin of a resolution profile to compute its sigmaN
+/// (SigBkgPlotter::SigmaAndWrite)
+const double SigmaMinEntries = 50;
+
+/// Clusters held by the TTreeCache of each task (--read-ahead)
+const double ReadAheadClusters = 1;
+
 const auto MyRed = TColor::GetColor("#E24A33");
 const auto MyBlue = TColor::GetColor("#348ABD");
 
-const std::map<TString,TString> ParticlesTitles {
-  {"B0", "B^{0}"}, {"Dst", "D*"}, {"D0", "D^{0}"},
-  {"mu", "#mu"}, {"K", "K"}, {"pisoft", "#pi_{soft}"},
-  {"pi", "#pi"}, {"pi1", "#pi_{1}"}, {"pi2", "#pi_{2}"}, {"pi3", "#pi_{3}"},
-  {"piH", "#pi_{1*}"}, {"piL", "#pi_{2*}"}
-};
+/// Titles of the particles in the plots, by name (see DecayChain.hh)
+const std::map<TString,TString> ParticlesTitles = KnownParticles::Titles();
 
 /// Condition that tells signal from mis-reconstructed / bkg
 extern const TString SignalCondition;
 
-/// Offline cuts common to Kpi and K3pi
+/// An atomic offline cut, with the binning of its variable for N-1 plots
+typedef struct OfflineCut {
+  TString name;       /**< Short name, e.g. "mu_dr". */
+  TString expression; /**< The cut, e.g. "mu_dr < 2". */
+  TString variable;   /**< Variable to plot (N-1 plots). */
+  TString title;      /**< Histogram title (N-1 plots). */
+  int nBins;
+  double xLow, xUp;
+} OfflineCut;
+
+/// Offline cuts common to Kpi and K3pi, one by one and all together
+extern const std::vector<OfflineCut> CommonCutsList;
 extern const TString CommonCuts;
 
-/// Offline cuts for Kpi only
+/// Offline cuts for Kpi only, one by one and all together
+extern const std::vector<OfflineCut> KpiCutsList;
 extern const TString KpiCuts;
 
-/// Offline cuts for K3pi only
+/// Offline cuts for K3pi only, one by one and all together
+extern const std::vector<OfflineCut> K3piCutsList;
 extern const TString K3piCuts;
 
-// Composite particles (D* and D0)
-const std::initializer_list<TString> CompositeParticles {"B0", "Dst", "D0"};
+/// A best candidate selection strategy: the candidates of each event are
+/// ranked by expression, the best one has the highest (or lowest) value
+typedef struct RankingStrategy {
+  TString name;       /**< Suffix for the plotters' names and the rank column. */
+  TString title;      /**< Title for plots and printouts. */
+  TString expression; /**< What to rank by. */
+  bool highest;       /**< true if the highest value is the best. */
+} RankingStrategy;
+
+/// Best candidate selection strategies, all evaluated after the offline cuts
+/// (the first one is the reference one)
+extern const std::vector<RankingStrategy> BCStrategies;
+
+/// Only the best BCMaxRank candidates of each event are ranked, the others
+/// get rank BCMaxRank + 1
+const int BCMaxRank = 5;
+
+/// A variation of the selection, booked in the same event loop as the nominal
+/// plots: the offline cuts whose names match cutsRegex (a PCRE), and a signal
+/// definition
+typedef struct Variation {
+  TString name;      /**< Suffix for the plotters' names and directories. */
+  TString title;     /**< Title for plots and printouts. */
+  TString cutsRegex; /**< Offline cuts applied ("" for none, ".*" for all). */
+  TString sigCond;   /**< Signal definition ("" for SignalCondition). */
+} Variation;
+
+/// Selection variations (--variations), after the loose, normal and tight
+/// CUTS of mdst2ntuple.py, and an alternative signal definition
+extern const std::vector<Variation> Variations;
+
+/// An axis of a cut scan: the cut "expression < threshold" (or ">" if not
+/// keepLow) is tried for nThresholds equally spaced thresholds in [low, up],
+/// instead of the offline cuts whose names match cutsRegex (a PCRE)
+typedef struct CutScanAxis {
+  TString name;       /**< Short name, for printouts and axis titles. */
+  TString expression; /**< Cut variable. */
+  int nThresholds;
+  double low, up;
+  bool keepLow;       /**< true for "expression < threshold". */
+  TString cutsRegex;  /**< Offline cuts replaced by the axis. */
+} CutScanAxis;
+
+/// Axes of the cut scan (the scanned offline cuts), for Kpi and K3pi; the
+/// other offline cuts are applied as they are (see CutScanBaseCuts)
+extern const std::vector<CutScanAxis> KpiCutScanAxes;
+extern const std::vector<CutScanAxis> K3piCutScanAxes;
+
+/// An axis of a resolution map: expression binned in nBins in [low, up].
+/// In name and expression, $p is replaced by the particle
+typedef struct ResolutionMapAxis {
+  TString name;       /**< Axis title. */
+  TString expression; /**< Binned variable. */
+  int nBins;
+  double low, up;
+} ResolutionMapAxis;
+
+/// A resolution map: a residual binned jointly with the other axes (the
+/// residual is the last axis), kept sparse by ResolutionMapAccumulator
+typedef struct ResolutionMapDef {
+  TString name; /**< Suffix of the histograms' names, e.g. "d0Residual". */
+  std::vector<ResolutionMapAxis> axes;
+} ResolutionMapDef;
+
+/// Resolution maps of each hard final state track (--resolution-maps)
+extern const std::vector<ResolutionMapDef> TrackResolutionMaps;
+
+/// Resolution maps of the D0 vertex (--resolution-maps)
+extern const std::vector<ResolutionMapDef> VertexResolutionMaps;
+
+/// Cells of a resolution map with fewer entries have no sigma68
+const double ResolutionMapMinEntries = 50;
+
+/// Variables of each final state particle exported by --export ($p_<name>)
+extern const std::vector<TString> ExportParticleVariables;
+
+/// Other variables exported by --export (the ranks of BCStrategies are added)
+extern const std::vector<TString> ExportEventVariables;
+
+/// Rows buffered per column and slot by the --export writers
+const size_t ExportBatchSize = 65536;
+
+/// Candidates of each slot whose offline cuts are sampled to find their
+/// cheapest order (CutOrderStats)
+const ULong64_t CutOrderSample = 100000;
+
+/// Estimated time (ns) to read a column of a candidate, added to the measured
+/// evaluation time of an offline cut for each column the cuts before it have
+/// not read (CutOrderStats)
+const double CutOrderReadCost = 20;
+
+/// Command that compiles the libraries of --jit-cache (the flags of
+/// root-config are added, as in compile.py)
+extern const TString JitCacheCompiler;
+
+/// Seconds after which the lock of an expression of --jit-cache is considered
+/// left by a killed job, and taken over
+const long JitCacheLockTimeout = 3600;
+
+/// Auto-ranged histograms (--auto-range, see AutoRange): the range is decided
+/// at the end of the loop, from the AutoRangeQuantile and
+/// 1 - AutoRangeQuantile quantiles of all the entries, widened by
+/// AutoRangeMargin times their distance on each side
+const double AutoRangeQuantile = 0.005;
+const double AutoRangeMargin = 0.1;
+
+/// Equal-population binning of the resolution profiles: the x axis is first
+/// binned in ProfileFineBins, then merged into ProfileQuantileBins bins with
+/// the same number of entries
+const int ProfileFineBins = 250;
+const int ProfileQuantileBins = 20;
+
+/// Fit models, with parameters named so that FitScheduler can guess their
+/// initial values from the histogram
+extern const TString SingleGaussian;
+extern const TString DoubleGaussian;
+
+// Particle lists of the channels (see DecayChain.hh), for the code that
+// selects the channel at run time
+
+// Composite particles (B0, D* and D0)
+const std::initializer_list<TString>& CompositeParticles = KpiChannel::Composites::Names();
 
 // Final state particles of Kpi
-const std::initializer_list<TString> KPiFSParticles {"mu", "K", "pi", "pisoft"};
+const std::initializer_list<TString>& KPiFSParticles = KpiChannel::FS::Names();
 
 // Final state particles of K3pi
-const std::initializer_list<TString> K3PiFSParticles {"mu", "K", "pi1", "pi2", "pi3", "pisoft"};
-const std::initializer_list<TString> K3PiFSParticlesSorted {"mu", "K", "piH", "piL", "pi3", "pisoft"};
+const std::initializer_list<TString>& K3PiFSParticles = K3piChannel::FS::Names();
+const std::initializer_list<TString>& K3PiFSParticlesSorted = K3piChannel::FSSorted::Names();
 
 // Final state hard particles of Kpi
-const std::initializer_list<TString> KPiFSHParticles {"mu", "K", "pi"};
+const std::initializer_list<TString>& KPiFSHParticles = KpiChannel::FSH::Names();
 
 // Final state hard particles of K3pi
-const std::initializer_list<TString> K3PiFSHParticles {"mu", "K", "pi1", "pi2", "pi3"};
-const std::initializer_list<TString> K3PiFSHParticlesSorted {"mu", "K", "piH", "piL", "pi3"};
+const std::initializer_list<TString>& K3PiFSHParticles = K3piChannel::FSH::Names();
+const std::initializer_list<TString>& K3PiFSHParticlesSorted = K3piChannel::FSHSorted::Names();
 
 // Final state pions of Kpi
-const std::initializer_list<TString> KPiPions {"pi", "pisoft"};
+const std::initializer_list<TString>& KPiPions = KpiChannel::Pions::Names();
 
 // Final state pions of K3pi
-const std::initializer_list<TString> K3PiPions {"pi1", "pi2", "pi3", "pisoft"};
-const std::initializer_list<TString> K3PiPionsSorted {"piH", "piL", "pi3", "pisoft"};
+const std::initializer_list<TString>& K3PiPions = K3piChannel::Pions::Names();
+const std::initializer_list<TString>& K3PiPionsSorted = K3piChannel::PionsSorted::Names();
 
 // All particles of Kpi
-const std::initializer_list<TString> KPiAllParticles {
-  "B0", "Dst", "D0", "mu",  "K", "pi", "pisoft"};
+const std::initializer_list<TString>& KPiAllParticles = KpiChannel::All::Names();
 
 // All particles of K3pi
-const std::initializer_list<TString> K3PiAllParticles {
-  "B0", "Dst", "D0", "mu",  "K", "pi1", "pi2", "pi3", "pisoft"};
-const std::initializer_list<TString> K3PiAllParticlesSorted {
-  "B0", "Dst", "D0", "mu",  "K", "piH", "piL", "pi3", "pisoft"};
+const std::initializer_list<TString>& K3PiAllParticles = K3piChannel::All::Names();
+const std::initializer_list<TString>& K3PiAllParticlesSorted = K3piChannel::AllSorted::Names();
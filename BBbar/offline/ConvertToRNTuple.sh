@@ -0,0 +1,8 @@
+#!/bin/bash
+# Wrapper for ConvertToRNTuple.C (compiled with ACLiC)
+# Usage ./ConvertToRNTuple.sh path/to/file.root [path/to/out.root]
+# The output defaults to path/to/file_rntuple.root
+scriptdir="$(dirname "$0")"
+macro="${scriptdir%/}/ConvertToRNTuple.C"
+out="${2:-${1%.root}_rntuple.root}"
+root -l -b -q "$macro+(\"$1\", \"$out\")"
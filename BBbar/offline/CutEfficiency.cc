@@ -39,6 +39,7 @@ tuple<TH2D*,UInt_t,UInt_t> CutEfficiencyAccumulator::GetResults() const
   auto h = new TH2D(GetUniqueName("hCandidates"),
                     "Candidates;Signal candidates;Background candidates;Events / bin",
                     25, -0.5, 24.5, NBinsY, YBins);
+  h->SetDirectory(nullptr); // Owned by the caller, not by gDirectory
   UInt_t nSig = 0, nBkg = 0;
   for (const auto& t : res) {
     const auto& cnt = t.second;
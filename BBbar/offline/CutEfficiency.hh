@@ -1,5 +1,6 @@
 #pragma once
 #include "Constants.hh"
+#include "JitCache.hh"
 #include <ROOT/RDataFrame.hxx>
 #include <tuple>
 #include <vector>
@@ -25,7 +26,7 @@ class CutEfficiencyAccumulator {
 
   CutEfficiencyAccumulator(int nSlots = NThreads) { m_slots.resize(nSlots); }
 
-  /** Should be called by RDataFrame::ForeachSlot with
+  /** Called in the event loop (see BookCutEfficiency) with the slot and
    * columns = {"__experiment__", "__run__", "__event__", "isSignal"}
    */
   void Accumulate(UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, bool sig);
@@ -40,6 +41,21 @@ class CutEfficiencyAccumulator {
   std::vector<table_t> m_slots;
 };
 
+/** Books the cut efficiency analysis of the given dataframe: accu is filled
+ * by the next event loop (lazy), whose entries are counted by the returned
+ * result (e.g. for RunGraphs).
+ */
+template <class T>
+ROOT::RDF::RResultPtr<ULong64_t> BookCutEfficiency(ROOT::RDF::RInterface<T,void>& df, CutEfficiencyAccumulator& accu)
+{
+  TString expr = TString::Format("(%s) ? 1.0 : 0.0", SignalCondition.Data());
+  return CachedDefine(df, "cutefftmp", expr).Filter(
+    [&accu](UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, double sig) {
+      accu.Accumulate(iSlot, exp, run, evt, sig == 1.0);
+      return true;
+    }, {"rdfslot_", "__experiment__", "__run__", "__event__", "cutefftmp"}).Count();
+}
+
 /** Runs the cut efficiency analysis on the given dataframe.
  * This is an instant action and will trigger data processing.
  */
@@ -47,11 +63,7 @@ template <class T>
 std::tuple<TH2D*,UInt_t,UInt_t> CutEfficiencyAnalysis(ROOT::RDF::RInterface<T,void>& df)
 {
   CutEfficiencyAccumulator accu;
-  TString expr = TString::Format("(%s) ? 1.0 : 0.0", SignalCondition.Data());
-  df.Define("cutefftmp", expr.Data()).ForeachSlot(
-    [&accu](UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, double sig) {
-      accu.Accumulate(iSlot, exp, run, evt, sig == 1.0);
-    }, {"__experiment__", "__run__", "__event__", "cutefftmp"});
+  BookCutEfficiency(df, accu).GetValue();
   return accu.GetResults();
 }
 
@@ -0,0 +1,120 @@
+#include "CutFlow.hh" // Own include
+#include "Utils.hh"
+#include "ResultWriter.hh"
+#include "JitCache.hh"
+#include <TH1.h>
+#include <iostream>
+using namespace std;
+
+vector<OfflineCut> GetOfflineCuts(bool isK3pi)
+{
+  vector<OfflineCut> cuts = CommonCutsList;
+  const auto& channelCuts = isK3pi ? K3piCutsList : KpiCutsList;
+  cuts.insert(cuts.end(), channelCuts.begin(), channelCuts.end());
+  return cuts;
+}
+
+TString CutMaskExpression(const vector<OfflineCut>& cuts)
+{
+  CHECKA(cuts.size() <= 32, TString::Format("%zu cuts", cuts.size()));
+  TString expr;
+  for (size_t i = 0; i < cuts.size(); i++)
+    expr += TString::Format("%s(UInt_t(%s) << %zu)", i ? " | " : "", cuts[i].expression.Data(), i);
+  return expr;
+}
+
+CutFlow::CutFlow(SigBkgPlotter::DefineDF& df, SigBkgPlotter::DefineDF& mcdf, const vector<OfflineCut>& cuts,
+                 TString sigCond, PDFCanvas& c, TString namePrefix, TString titlePrefix)
+: m_cuts(cuts), m_namePrefix(namePrefix), m_titlePrefix(titlePrefix)
+{
+  const int n = m_cuts.size();
+  const UInt_t all = CutMaskAll(m_cuts);
+  auto ddf = df.Define("cutflowSeq", [n](UInt_t mask) {
+    int i = 0;
+    while (i < n && (mask >> i & 1u)) i++;
+    return i;
+  }, {"offlineCutsMask"}).Define("cutflowNm1", [n, all](UInt_t mask) {
+    const UInt_t failed = ~mask & all;
+    if (failed == 0) return n;
+    if (failed & (failed - 1)) return -1; // More than one
+    int i = 0;
+    while (!(failed >> i & 1u)) i++;
+    return i;
+  }, {"offlineCutsMask"});
+
+  auto sig = CachedFilter(ddf, sigCond, "Signal");
+  auto bkg = CachedFilter(ddf, "!(" + sigCond + ")", "Background");
+  m_seqSig = sig.Histo1D<int>({GetUniqueName(m_namePrefix + "_cutflowSeq_sig"), "", n + 1, -0.5, n + 0.5}, "cutflowSeq");
+  m_seqBkg = bkg.Histo1D<int>({GetUniqueName(m_namePrefix + "_cutflowSeq_bkg"), "", n + 1, -0.5, n + 0.5}, "cutflowSeq");
+  m_nm1Sig = sig.Histo1D<int>({GetUniqueName(m_namePrefix + "_cutflowNm1_sig"), "", n + 2, -1.5, n + 0.5}, "cutflowNm1");
+  m_nm1Bkg = bkg.Histo1D<int>({GetUniqueName(m_namePrefix + "_cutflowNm1_bkg"), "", n + 2, -1.5, n + 0.5}, "cutflowNm1");
+
+  // N-1 distributions: all cuts but the i-th one passed
+  for (int i = 0; i < n; i++) {
+    const auto& cut = m_cuts[i];
+    auto dfNm1 = CachedFilter(df, TString::Format("(offlineCutsMask | %uu) == %uu", 1u << i, all),
+                              "N-1 " + cut.name);
+    m_nm1Plotters.push_back(make_unique<SigBkgPlotter>(
+      dfNm1, mcdf, sigCond, c, m_namePrefix + "Nm1_" + cut.name, m_titlePrefix + " N-1"));
+    m_nm1Plotters.back()->Histo1D(cut.variable, cut.title, cut.nBins, cut.xLow, cut.xUp);
+  }
+}
+
+void CutFlow::Print(UInt_t nMC)
+{
+  const int n = m_cuts.size();
+  // Bin i + 1 of seq = i leading cuts passed, bin i + 2 of nm1 = only cut i failed
+  auto seqPass = [n](TH1* h, int i) { return h->Integral(i + 2, n + 1); }; // Cuts 0..i passed
+  auto nm1Pass = [n](TH1* h, int i) { return h->GetBinContent(i + 2) + h->GetBinContent(n + 2); };
+  const double allSig = m_nm1Sig->GetBinContent(n + 2), allBkg = m_nm1Bkg->GetBinContent(n + 2);
+  const double totSig = m_seqSig->Integral(), totBkg = m_seqBkg->Integral();
+
+  TString name = m_namePrefix + "_cutflow";
+  TH1D hSeqSig(name + "_seq_sig", m_titlePrefix + " - Sequential cut flow (signal);;Candidates", n + 1, 0, n + 1);
+  TH1D hSeqBkg(name + "_seq_bkg", m_titlePrefix + " - Sequential cut flow (bkg);;Candidates", n + 1, 0, n + 1);
+  TH1D hNm1Sig(name + "_nm1_sig", m_titlePrefix + " - N-1 efficiency (signal);;Efficiency", n, 0, n);
+  TH1D hNm1Bkg(name + "_nm1_bkg", m_titlePrefix + " - N-1 efficiency (bkg);;Efficiency", n, 0, n);
+  hSeqSig.GetXaxis()->SetBinLabel(1, "No cuts");
+  hSeqBkg.GetXaxis()->SetBinLabel(1, "No cuts");
+  hSeqSig.SetBinContent(1, totSig);
+  hSeqBkg.SetBinContent(1, totBkg);
+
+  TString fs;
+  cout << m_titlePrefix << " cut flow (sequential: w.r.t. the previous cut; N-1: w.r.t. all the others)" << endl;
+  cout << "   Cut              | Seq. sig | Seq. bkg |Seq.s.eff.|Seq.b.eff.|N-1 s.eff.|N-1 b.eff." << endl;
+  cout << "   -----------------+----------+----------+----------+----------+----------+----------" << endl;
+  double prevSig = totSig, prevBkg = totBkg;
+  for (int i = 0; i < n; i++) {
+    const double s = seqPass(m_seqSig.GetPtr(), i), b = seqPass(m_seqBkg.GetPtr(), i);
+    const double ns = nm1Pass(m_nm1Sig.GetPtr(), i), nb = nm1Pass(m_nm1Bkg.GetPtr(), i);
+    fs.Form("   %-17s|%10.0f|%10.0f|%9.4g%%|%9.4g%%|%9.4g%%|%9.4g%%", m_cuts[i].name.Data(), s, b,
+            100.0 * s / prevSig, 100.0 * b / prevBkg, 100.0 * allSig / ns, 100.0 * allBkg / nb);
+    cout << fs << endl;
+    prevSig = s;
+    prevBkg = b;
+    hSeqSig.GetXaxis()->SetBinLabel(i + 2, m_cuts[i].name);
+    hSeqBkg.GetXaxis()->SetBinLabel(i + 2, m_cuts[i].name);
+    hSeqSig.SetBinContent(i + 2, s);
+    hSeqBkg.SetBinContent(i + 2, b);
+    hNm1Sig.GetXaxis()->SetBinLabel(i + 1, m_cuts[i].name);
+    hNm1Bkg.GetXaxis()->SetBinLabel(i + 1, m_cuts[i].name);
+    hNm1Sig.SetBinContent(i + 1, ns == 0 ? 0.0 : allSig / ns);
+    hNm1Bkg.SetBinContent(i + 1, nb == 0 ? 0.0 : allBkg / nb);
+  }
+  fs.Form("   All cuts: signal %.0f (%.4g%% of MC), background %.0f", allSig, 100.0 * allSig / nMC, allBkg);
+  cout << fs << endl;
+
+  for (TH1* h : {&hSeqSig, &hSeqBkg, &hNm1Sig, &hNm1Bkg})
+    WriteResult(h);
+  for (const auto& plt : m_nm1Plotters)
+    plt->PrintAll();
+}
+
+vector<TH1*> CutFlow::GetAllHistos()
+{
+  vector<TH1*> res {m_seqSig.GetPtr(), m_seqBkg.GetPtr(), m_nm1Sig.GetPtr(), m_nm1Bkg.GetPtr()};
+  for (const auto& plt : m_nm1Plotters)
+    for (TH1* h : plt->GetAllHistos())
+      res.push_back(h);
+  return res;
+}
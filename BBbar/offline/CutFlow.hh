@@ -0,0 +1,60 @@
+#pragma once
+#include "SigBkgPlotter.hh"
+#include "Constants.hh"
+#include <memory>
+#include <vector>
+
+/** Returns the offline cuts of a channel, one by one (CommonCutsList
+ * followed by KpiCutsList or K3piCutsList).
+ */
+std::vector<OfflineCut> GetOfflineCuts(bool isK3pi);
+
+/** Returns the expression of the bitmask of the passed cuts: bit i is set
+ * if cuts[i] is passed. Up to 32 cuts.
+ */
+TString CutMaskExpression(const std::vector<OfflineCut>& cuts);
+
+/** Returns the value of the bitmask when all the cuts are passed. */
+inline UInt_t CutMaskAll(const std::vector<OfflineCut>& cuts)
+{
+  return cuts.size() >= 32 ? ~0u : (1u << cuts.size()) - 1;
+}
+
+/** Cut flow of the offline cuts: sequential and N-1 efficiencies for signal
+ * and background, and N-1 distributions of each cut variable. Everything is
+ * booked lazily from the "offlineCutsMask" column, so it is filled in the
+ * same event loop as the other plots.
+ */
+class CutFlow {
+ public:
+  CutFlow() = delete;
+  CutFlow(const CutFlow&) = delete;
+  CutFlow(CutFlow&&) = delete;
+  CutFlow& operator=(const CutFlow&) = delete;
+  CutFlow& operator=(CutFlow&&) = delete;
+
+  /** Books the cut flow on df, which must have the "offlineCutsMask" column
+   * computed with the same cuts. N-1 distributions are printed to c.
+   */
+  CutFlow(SigBkgPlotter::DefineDF& df, SigBkgPlotter::DefineDF& mcdf, const std::vector<OfflineCut>& cuts,
+          TString sigCond, PDFCanvas& c, TString namePrefix, TString titlePrefix);
+
+  /** Prints the cut flow table, writes the cut flow histograms to the
+   * current directory and prints the N-1 distributions.
+   * @param nMC Number of MC signal events, for the absolute efficiencies
+   */
+  void Print(UInt_t nMC);
+
+  /** Returns all the histograms booked (triggers the event loop). */
+  std::vector<TH1*> GetAllHistos();
+
+ private:
+  std::vector<OfflineCut> m_cuts;
+  TString m_namePrefix;
+  TString m_titlePrefix;
+  SigBkgPlotter::RRes1D m_seqSig; /**< Number of leading cuts passed, signal. */
+  SigBkgPlotter::RRes1D m_seqBkg; /**< Number of leading cuts passed, background. */
+  SigBkgPlotter::RRes1D m_nm1Sig; /**< Only failed cut (-1 if more, N if none), signal. */
+  SigBkgPlotter::RRes1D m_nm1Bkg; /**< Only failed cut (-1 if more, N if none), background. */
+  std::vector<std::unique_ptr<SigBkgPlotter>> m_nm1Plotters; /**< N-1 distributions, one per cut. */
+};
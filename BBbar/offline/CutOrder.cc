@@ -0,0 +1,177 @@
+#include "CutOrder.hh" // Own include
+#include "Utils.hh"
+#include "JitCache.hh"
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+#include <set>
+using namespace std;
+
+CutOrderStats::CutOrderStats(const vector<OfflineCut>& cuts, const vector<string>& columns, int nSlots)
+: m_cuts(cuts), m_slots(nSlots), m_sampled(nSlots, 0), m_times(nSlots, vector<double>(cuts.size(), 0)),
+  m_starts(nSlots)
+{
+  CHECKA(m_cuts.size() <= 32, TString::Format("%zu cuts", m_cuts.size()));
+  // The identifiers of each expression that are columns
+  for (const auto& cut : m_cuts) {
+    set<int> reads;
+    const string expr = cut.expression.Data();
+    for (size_t i = 0; i < expr.size();) {
+      if (!isalpha(expr[i]) && expr[i] != '_') {
+        i++;
+        continue;
+      }
+      size_t j = i;
+      while (j < expr.size() && (isalnum(expr[j]) || expr[j] == '_')) j++;
+      auto it = find(columns.begin(), columns.end(), expr.substr(i, j - i));
+      if (it != columns.end())
+        reads.insert(it - columns.begin());
+      i = j;
+    }
+    m_reads.emplace_back(reads.begin(), reads.end());
+  }
+}
+
+bool CutOrderStats::Accumulate(UInt_t iSlot, UInt_t mask)
+{
+  if (m_sampled[iSlot] >= CutOrderSample) return false;
+  m_sampled[iSlot]++;
+  m_slots[iSlot][mask]++;
+  return true;
+}
+
+unordered_map<UInt_t,double> CutOrderStats::GetMasks() const
+{
+  unordered_map<UInt_t,double> res;
+  for (const auto& slot : m_slots)
+    for (const auto& [mask, n] : slot)
+      res[mask] += n;
+  return res;
+}
+
+double CutOrderStats::GetCost(int i, const vector<bool>& done) const
+{
+  ULong64_t sampled = 0;
+  double time = 0;
+  for (size_t slot = 0; slot < m_slots.size(); slot++) {
+    sampled += m_sampled[slot];
+    time += m_times[slot][i];
+  }
+  double cost = sampled > 0 ? time / sampled : 0;
+  for (int c : m_reads[i]) {
+    bool read = false;
+    for (size_t j = 0; j < m_cuts.size() && !read; j++)
+      read = done[j] && find(m_reads[j].begin(), m_reads[j].end(), c) != m_reads[j].end();
+    if (!read) cost += CutOrderReadCost;
+  }
+  return max(cost, 1e-3); // Not 0 below the resolution of the clock
+}
+
+vector<int> CutOrderStats::GetOrder() const
+{
+  const int n = m_cuts.size();
+  auto masks = GetMasks();
+  vector<pair<UInt_t,double>> left(masks.begin(), masks.end()); // Candidates that passed the cuts so far
+  vector<bool> done(n, false);
+  vector<int> order;
+  if (left.empty()) { // Nothing sampled
+    order.resize(n);
+    iota(order.begin(), order.end(), 0);
+    return order;
+  }
+  while ((int)order.size() < n) {
+    double wLeft = 0;
+    for (const auto& [mask, w] : left)
+      wLeft += w;
+    int best = -1;
+    double bestScore = -1, bestCost = 0;
+    for (int i = 0; i < n; i++) {
+      if (done[i]) continue;
+      double wFail = 0;
+      for (const auto& [mask, w] : left)
+        if (!(mask >> i & 1u)) wFail += w;
+      const double cost = GetCost(i, done);
+      const double score = (wLeft > 0 ? wFail / wLeft : 0) / cost;
+      if (score > bestScore || (score == bestScore && cost < bestCost)) {
+        best = i;
+        bestScore = score;
+        bestCost = cost;
+      }
+    }
+    order.push_back(best);
+    done[best] = true;
+    left.erase(remove_if(left.begin(), left.end(), [best](const pair<UInt_t,double>& m) {
+      return !(m.first >> best & 1u);
+    }), left.end());
+  }
+  return order;
+}
+
+double CutOrderStats::GetExpectedCost(const vector<int>& order) const
+{
+  const auto masks = GetMasks();
+  double total = 0;
+  for (const auto& [mask, w] : masks)
+    total += w;
+  if (total == 0) return 0;
+  vector<bool> done(m_cuts.size(), false);
+  UInt_t passed = 0; // Cuts of order done so far
+  double cost = 0;
+  for (int i : order) {
+    double wReached = 0;
+    for (const auto& [mask, w] : masks)
+      if ((mask & passed) == passed) wReached += w;
+    cost += wReached / total * GetCost(i, done);
+    done[i] = true;
+    passed |= 1u << i;
+  }
+  return cost;
+}
+
+TString CutOrderStats::GetSummary() const
+{
+  ULong64_t sampled = 0;
+  for (ULong64_t n : m_sampled)
+    sampled += n;
+  const auto order = GetOrder();
+  vector<int> written(m_cuts.size());
+  iota(written.begin(), written.end(), 0);
+  TString names;
+  for (int i : order)
+    names += (names.IsNull() ? "" : ", ") + m_cuts[i].name;
+  return TString::Format("Offline cuts order: %s (%.1f ns per candidate, %.1f in the written order, "
+                         "%llu candidates sampled)", names.Data(), GetExpectedCost(order),
+                         GetExpectedCost(written), sampled);
+}
+
+ROOT::RDF::RResultPtr<ULong64_t> BookCutOrderStats(ROOT::RDF::RNode df, CutOrderStats& stats)
+{
+  // The mask reads the columns of all the cuts, so the timers below only
+  // measure the evaluation of each one
+  df = df.Filter([&stats](UInt_t iSlot, UInt_t mask) {
+    return stats.Accumulate(iSlot, mask);
+  }, {"rdfslot_", "offlineCutsMask"});
+  const auto& cuts = stats.GetCuts();
+  for (size_t i = 0; i < cuts.size(); i++) {
+    // The column is only evaluated when the second filter asks for it
+    df = df.Filter([&stats](UInt_t iSlot) {
+      stats.StartTimer(iSlot);
+      return true;
+    }, {"rdfslot_"});
+    const TString pass = TString::Format("cutOrderPass%zu", i);
+    df = CachedDefine(df, pass, "bool(" + cuts[i].expression + ")");
+    df = df.Filter([&stats, i](UInt_t iSlot, bool) {
+      stats.StopTimer(iSlot, i);
+      return true;
+    }, {"rdfslot_", pass.Data()});
+  }
+  return df.Count();
+}
+
+SigBkgPlotter::FilterDF ApplyCutsInOrder(SigBkgPlotter::FilterDF df, const vector<OfflineCut>& cuts,
+                                         const vector<int>& order)
+{
+  for (int i : order)
+    df = CachedFilter(df, cuts[i].expression, "Offline cut " + cuts[i].name);
+  return df;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "SigBkgPlotter.hh"
+#include "Constants.hh"
+#include <ROOT/RDataFrame.hxx>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Finds the order of the offline cuts with the lowest expected cost per
+ * candidate, when they are evaluated one after the other until one fails:
+ * cheap and selective cuts first. Every order selects the same candidates.
+ *
+ * The pass patterns of the cuts (the offlineCutsMask values) of the first
+ * CutOrderSample candidates of each slot are counted, so that the pass rate
+ * of a cut is known after any set of cuts, correlations included. On the
+ * same candidates, each cut is evaluated again on its own, and timed. The
+ * cost of a cut is that time plus CutOrderReadCost per column it reads that
+ * the previous cuts have not read: the reads themselves are not timed, since
+ * in a shared event loop a column is read by whichever node needs it first.
+ */
+class CutOrderStats {
+ public:
+  CutOrderStats() = delete;
+  CutOrderStats(const CutOrderStats&) = delete;
+  CutOrderStats(CutOrderStats&&) = delete;
+  CutOrderStats& operator=(const CutOrderStats&) = delete;
+  CutOrderStats& operator=(CutOrderStats&&) = delete;
+
+  /** @param columns Columns of the dataframe, to find those read by each cut */
+  CutOrderStats(const std::vector<OfflineCut>& cuts, const std::vector<std::string>& columns,
+                int nSlots = NThreads);
+
+  /** Called in the event loop (see BookCutOrderStats): counts the pass
+   * pattern of a candidate, and returns whether it is sampled.
+   */
+  bool Accumulate(UInt_t iSlot, UInt_t mask);
+
+  /** Called in the event loop (see BookCutOrderStats) before evaluating a cut. */
+  void StartTimer(UInt_t iSlot) { m_starts[iSlot] = std::chrono::steady_clock::now(); }
+
+  /** Called in the event loop (see BookCutOrderStats) after evaluating cut i. */
+  void StopTimer(UInt_t iSlot, int i)
+  {
+    const auto elapsed = std::chrono::steady_clock::now() - m_starts[iSlot];
+    m_times[iSlot][i] += std::chrono::duration<double,std::nano>(elapsed).count();
+  }
+
+  const std::vector<OfflineCut>& GetCuts() const { return m_cuts; }
+
+  /** The indices of the cuts, cheapest order first (greedy: the cut that
+   * rejects the most candidates left per unit of cost comes next). The
+   * written order if nothing was sampled.
+   */
+  std::vector<int> GetOrder() const;
+
+  /** Expected cost per candidate of the cuts in the given order, in ns. */
+  double GetExpectedCost(const std::vector<int>& order) const;
+
+  /** One line with the best order and its expected cost vs the written one. */
+  TString GetSummary() const;
+
+ private:
+  /** Merged counts of the candidates by pass pattern. */
+  std::unordered_map<UInt_t,double> GetMasks() const;
+
+  /** Cost of cuts[i] when the columns of the cuts in done are read already. */
+  double GetCost(int i, const std::vector<bool>& done) const;
+
+  std::vector<OfflineCut> m_cuts;
+  std::vector<std::vector<int>> m_reads; /**< Indices of the columns read by each cut. */
+  std::vector<std::unordered_map<UInt_t,ULong64_t>> m_slots; /**< Candidates by pass pattern, per slot. */
+  std::vector<ULong64_t> m_sampled; /**< Per slot. */
+  std::vector<std::vector<double>> m_times; /**< Total evaluation time of each cut (ns), per slot. */
+  std::vector<std::chrono::steady_clock::time_point> m_starts; /**< Per slot, see StartTimer. */
+};
+
+/** Books the sampling of the pass patterns and of the evaluation times of
+ * the cuts of stats on df (with the offlineCutsMask column), in the next
+ * event loop (lazy), whose sampled candidates are counted by the returned
+ * result.
+ */
+ROOT::RDF::RResultPtr<ULong64_t> BookCutOrderStats(ROOT::RDF::RNode df, CutOrderStats& stats);
+
+/** Applies cuts to df as a chain of filters in the given order (indices in
+ * cuts, see CutOrderStats::GetOrder): each cut is only evaluated on the
+ * candidates that passed the previous ones.
+ */
+SigBkgPlotter::FilterDF ApplyCutsInOrder(SigBkgPlotter::FilterDF df, const std::vector<OfflineCut>& cuts,
+                                         const std::vector<int>& order);
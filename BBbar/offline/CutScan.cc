@@ -0,0 +1,119 @@
+#include "CutScan.hh" // Own include
+#include "Utils.hh"
+#include <THn.h> // THnD is forward declared
+#include <TMath.h>
+#include <TPRegexp.h>
+using namespace std;
+
+TString CutScanBaseCuts(const vector<OfflineCut>& cuts, const vector<CutScanAxis>& axes)
+{
+  vector<bool> scanned(cuts.size(), false);
+  for (const auto& a : axes) {
+    TPRegexp re(a.cutsRegex);
+    bool found = false;
+    for (size_t i = 0; i < cuts.size(); i++) {
+      if (re.MatchB(cuts[i].name)) {
+        scanned[i] = true;
+        found = true;
+      }
+    }
+    CHECKA(found, "no offline cut matches " + a.cutsRegex + " (" + a.name + ")");
+  }
+  TString res;
+  for (size_t i = 0; i < cuts.size(); i++)
+    if (!scanned[i])
+      res += (res.IsNull() ? "" : " && ") + cuts[i].expression;
+  return res.IsNull() ? "true"TS : res;
+}
+
+CutScanAccumulator::CutScanAccumulator(const vector<CutScanAxis>& axes, int nSlots)
+: m_axes(axes), m_nCells(1)
+{
+  for (const auto& a : m_axes) {
+    CHECKA(a.nThresholds > 0, a.name);
+    m_nCells *= a.nThresholds;
+  }
+  CHECKA(m_nCells <= 10000000, TString::Format("%lld cells", m_nCells));
+  m_sig.resize(nSlots);
+  m_bkg.resize(nSlots);
+}
+
+int CutScanAccumulator::ThresholdIndex(const CutScanAxis& a, double value) const
+{
+  if (TMath::IsNaN(value)) return -1; // Fails every cut, like in a Filter
+  const double step = a.nThresholds > 1 ? (a.up - a.low) / (a.nThresholds - 1) : 1.0;
+  const double x = (value - a.low) / step;
+  if (a.keepLow) { // Passes low + j * step > value for j >= floor(x) + 1
+    const double j = TMath::Max(TMath::Floor(x) + 1, 0.0);
+    return j < a.nThresholds ? (int)j : -1;
+  } else { // Passes low + j * step < value for j <= ceil(x) - 1
+    const double j = TMath::Min(TMath::Ceil(x) - 1, a.nThresholds - 1.0);
+    return j >= 0 ? (int)j : -1;
+  }
+}
+
+void CutScanAccumulator::Accumulate(UInt_t iSlot, bool sig, const ROOT::RVec<double>& values)
+{
+  Long64_t cell = 0;
+  for (size_t i = 0; i < m_axes.size(); i++) {
+    const int j = ThresholdIndex(m_axes[i], values[i]);
+    if (j < 0) return;
+    cell = cell * m_axes[i].nThresholds + j;
+  }
+  auto& counts = sig ? m_sig[iSlot] : m_bkg[iSlot];
+  if (counts.empty()) counts.resize(m_nCells, 0.0);
+  counts[cell]++;
+}
+
+tuple<THnD*,THnD*> CutScanAccumulator::GetResults(TString name) const
+{
+  const int dim = m_axes.size();
+  vector<int> nBins;
+  vector<double> xMin, xMax;
+  for (const auto& a : m_axes) {
+    const double step = a.nThresholds > 1 ? (a.up - a.low) / (a.nThresholds - 1) : 1.0;
+    nBins.push_back(a.nThresholds);
+    xMin.push_back(a.low - step / 2);
+    xMax.push_back(a.up + step / 2);
+  }
+
+  auto makeHisto = [&](const vector<vector<double>>& slots, TString suffix) {
+    // Merge slots
+    vector<double> counts(m_nCells, 0.0);
+    for (const auto& slot : slots)
+      for (Long64_t c = 0; c < (Long64_t)slot.size(); c++)
+        counts[c] += slot[c];
+
+    // Cumulative sum along each axis (last axis has stride 1)
+    Long64_t stride = 1;
+    for (int i = dim - 1; i >= 0; i--) {
+      const auto& a = m_axes[i];
+      const Long64_t span = stride * a.nThresholds;
+      for (Long64_t c = 0; c < m_nCells; c++) {
+        const Long64_t j = (c / stride) % a.nThresholds;
+        if (a.keepLow && j > 0)
+          counts[c] += counts[c - stride];
+        else if (!a.keepLow && j == 0) // Descending, done once per line
+          for (Long64_t k = c + span - 2 * stride; k >= c; k -= stride)
+            counts[k] += counts[k + stride];
+      }
+      stride = span;
+    }
+
+    auto h = new THnD(GetUniqueName(name + suffix), name + suffix, dim, nBins.data(), xMin.data(), xMax.data());
+    for (int i = 0; i < dim; i++)
+      h->GetAxis(i)->SetTitle(m_axes[i].name);
+    vector<int> idx(dim);
+    for (Long64_t c = 0; c < m_nCells; c++) {
+      Long64_t rest = c;
+      for (int i = dim - 1; i >= 0; i--) {
+        idx[i] = rest % m_axes[i].nThresholds + 1;
+        rest /= m_axes[i].nThresholds;
+      }
+      h->SetBinContent(idx.data(), counts[c]);
+    }
+    return h;
+  };
+
+  return make_tuple(makeHisto(m_sig, "_sig"), makeHisto(m_bkg, "_bkg"));
+}
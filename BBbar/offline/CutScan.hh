@@ -0,0 +1,86 @@
+#pragma once
+#include "Constants.hh"
+#include "JitCache.hh"
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <tuple>
+#include <vector>
+class THnD; // Forward declaration
+
+/** Counts the signal and background candidates that pass every combination
+ * of thresholds of a cut scan, in a single event loop.
+ *
+ * Each candidate is filled once, in the cell of the tightest thresholds it
+ * passes; the counts for all the combinations are obtained at the end with
+ * a cumulative sum along each axis.
+ */
+class CutScanAccumulator {
+ public:
+  CutScanAccumulator() = delete;
+  CutScanAccumulator(const CutScanAccumulator&) = delete;
+  CutScanAccumulator(CutScanAccumulator&&) = delete;
+  CutScanAccumulator& operator=(const CutScanAccumulator&) = delete;
+  CutScanAccumulator& operator=(CutScanAccumulator&&) = delete;
+
+  CutScanAccumulator(const std::vector<CutScanAxis>& axes, int nSlots = NThreads);
+
+  /** Called in the event loop (see BookCutScan) with the slot and
+   * columns = {"isSignal", "values"}, with one value per axis.
+   */
+  void Accumulate(UInt_t iSlot, bool sig, const ROOT::RVec<double>& values);
+
+  /** Returns the {sig,bkg} histograms with the number of candidates that
+   * pass each combination of thresholds (one bin per combination).
+   */
+  std::tuple<THnD*,THnD*> GetResults(TString name) const;
+
+ private:
+  /** Returns the index of the tightest threshold of axis passed by value,
+   * or -1 if none is passed.
+   */
+  int ThresholdIndex(const CutScanAxis& axis, double value) const;
+
+  std::vector<CutScanAxis> m_axes;
+  Long64_t m_nCells;
+  std::vector<std::vector<double>> m_sig; /**< Per slot, not cumulated. */
+  std::vector<std::vector<double>> m_bkg; /**< Per slot, not cumulated. */
+};
+
+/** Returns the offline cuts that are not replaced by any of the axes (see
+ * CutScanAxis::cutsRegex), all together.
+ */
+TString CutScanBaseCuts(const std::vector<OfflineCut>& cuts, const std::vector<CutScanAxis>& axes);
+
+/** Books the cut scan of the candidates of df that pass baseCuts: accu
+ * (built with the same axes) is filled by the next event loop (lazy), whose
+ * scanned candidates are counted by the returned result (e.g. for RunGraphs).
+ */
+template <class T>
+ROOT::RDF::RResultPtr<ULong64_t> BookCutScan(ROOT::RDF::RInterface<T,void>& df, const std::vector<CutScanAxis>& axes,
+                                             TString baseCuts, CutScanAccumulator& accu)
+{
+  TString valuesExpr = "ROOT::RVec<double>{";
+  for (const auto& a : axes)
+    valuesExpr += (valuesExpr.EndsWith("{") ? "double(" : ", double(") + a.expression + ")";
+  valuesExpr += "}";
+  TString sigExpr = TString::Format("(%s) ? 1.0 : 0.0", SignalCondition.Data());
+
+  auto dfBase = CachedFilter(df, baseCuts, "Cut scan base cuts");
+  return CachedDefine(CachedDefine(dfBase, "cutscantmpSig", sigExpr), "cutscantmpValues", valuesExpr)
+    .Filter([&accu](UInt_t iSlot, double sig, const ROOT::RVec<double>& values) {
+      accu.Accumulate(iSlot, sig == 1.0, values);
+      return true;
+    }, {"rdfslot_", "cutscantmpSig", "cutscantmpValues"}).Count();
+}
+
+/** Runs the cut scan on the candidates of df that pass baseCuts.
+ * This is an instant action and will trigger data processing.
+ */
+template <class T>
+std::tuple<THnD*,THnD*> CutScanAnalysis(ROOT::RDF::RInterface<T,void>& df, const std::vector<CutScanAxis>& axes,
+                                        TString baseCuts, TString name)
+{
+  CutScanAccumulator accu(axes);
+  BookCutScan(df, axes, baseCuts, accu).GetValue();
+  return accu.GetResults(name);
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <TString.h>
+#include <initializer_list>
+#include <map>
+#include <type_traits>
+
+/** Compile-time descriptors of the decay chains.
+ *
+ * A particle is a type with the prefix of its columns (name) and its title in
+ * the plots. A chain is a Decay<Mother, Daughters...>, whose daughters are
+ * particles or other decays. Its composite and final state particles are
+ * ParticleLists computed by the compiler, in the order of the columns and of
+ * the plots. A Channel gathers the lists used by ana to define the columns
+ * and book the plots, so that the code is written once for all the channels.
+ */
+namespace Particle {
+  struct B0     { static constexpr const char *name = "B0",     *title = "B^{0}"; };
+  struct Dst    { static constexpr const char *name = "Dst",    *title = "D*"; };
+  struct D0     { static constexpr const char *name = "D0",     *title = "D^{0}"; };
+  struct Mu     { static constexpr const char *name = "mu",     *title = "#mu"; };
+  struct K      { static constexpr const char *name = "K",      *title = "K"; };
+  struct PiSoft { static constexpr const char *name = "pisoft", *title = "#pi_{soft}"; };
+  struct Pi     { static constexpr const char *name = "pi",     *title = "#pi"; };
+  struct Pi1    { static constexpr const char *name = "pi1",    *title = "#pi_{1}"; };
+  struct Pi2    { static constexpr const char *name = "pi2",    *title = "#pi_{2}"; };
+  struct Pi3    { static constexpr const char *name = "pi3",    *title = "#pi_{3}"; };
+  struct PiH    { static constexpr const char *name = "piH",    *title = "#pi_{1*}"; }; // pi1/pi2 with higher pT
+  struct PiL    { static constexpr const char *name = "piL",    *title = "#pi_{2*}"; }; // pi1/pi2 with lower pT
+}
+
+/** An ordered list of particle types. */
+template <class... Ps>
+struct ParticleList {
+  static constexpr size_t Size = sizeof...(Ps);
+
+  /** True if P is in the list. */
+  template <class P>
+  static constexpr bool Has = (std::is_same_v<P, Ps> || ...);
+
+  /** The names, as taken by SigBkgPlotter and defineVarsForParticles. Built
+   * on first use, so that it can initialize other globals.
+   */
+  static const std::initializer_list<TString>& Names()
+  {
+    static const std::initializer_list<TString> names {Ps::name...};
+    return names;
+  }
+
+  /** {name, title} of each particle. */
+  static std::map<TString,TString> Titles() { return {{Ps::name, Ps::title}...}; }
+};
+
+template <class... Lists> struct ConcatT;
+template <> struct ConcatT<> { using type = ParticleList<>; };
+template <class... A> struct ConcatT<ParticleList<A...>> { using type = ParticleList<A...>; };
+template <class... A, class... B, class... Rest>
+struct ConcatT<ParticleList<A...>, ParticleList<B...>, Rest...> {
+  using type = typename ConcatT<ParticleList<A..., B...>, Rest...>::type;
+};
+
+/** The particles of all the Lists, in order. */
+template <class... Lists>
+using Concat = typename ConcatT<Lists...>::type;
+
+template <class List, class... Removed> struct RemoveT;
+template <class... Ps, class... Removed>
+struct RemoveT<ParticleList<Ps...>, Removed...> {
+  using type = Concat<std::conditional_t<ParticleList<Removed...>::template Has<Ps>,
+                                         ParticleList<>, ParticleList<Ps>>...>;
+};
+
+/** List without the particles Removed. */
+template <class List, class... Removed>
+using Remove = typename RemoveT<List, Removed...>::type;
+
+template <class Mother, class... Daughters> struct Decay;
+
+/** Particles of a node of a chain: a particle is a final state one. */
+template <class P>
+struct ChainParticles {
+  using Composites = ParticleList<>;
+  using FinalState = ParticleList<P>;
+};
+template <class Mother, class... Daughters>
+struct ChainParticles<Decay<Mother, Daughters...>> {
+  using Composites = Concat<ParticleList<Mother>, typename ChainParticles<Daughters>::Composites...>;
+  using FinalState = Concat<typename ChainParticles<Daughters>::FinalState...>;
+};
+
+/** Mother -> Daughters, the daughters being particles or decays. */
+template <class Mother, class... Daughters>
+struct Decay {
+  /** Mother first, then the composite daughters (depth first). */
+  using Composites = typename ChainParticles<Decay>::Composites;
+  /** In the order of the daughters (depth first). */
+  using FinalState = typename ChainParticles<Decay>::FinalState;
+};
+
+/** A reconstructed channel.
+ * @tparam Chain The decay, with the particles of the ntuples
+ * @tparam SortedChain The same decay with the particles of the plots, if
+ *         different (piH and piL are pi1 and pi2 sorted by pT)
+ */
+template <class Chain, class SortedChain = Chain>
+struct Channel {
+  using Composites = typename Chain::Composites;
+  using FS = typename Chain::FinalState;
+  using FSSorted = typename SortedChain::FinalState;
+  /** Final state hard particles (without the soft pion). */
+  using FSH = Remove<FS, Particle::PiSoft>;
+  using FSHSorted = Remove<FSSorted, Particle::PiSoft>;
+  using Pions = Remove<FS, Particle::Mu, Particle::K>;
+  using PionsSorted = Remove<FSSorted, Particle::Mu, Particle::K>;
+  using All = Concat<Composites, FS>;
+  using AllSorted = Concat<Composites, FSSorted>;
+
+  /** True if some particles are sorted (defineVariables defines them). */
+  static constexpr bool Sorted = !std::is_same_v<Chain, SortedChain>;
+};
+
+/// B0 -> D* mu nu, D* -> D0 pi_soft, D0 -> K pi
+using KpiChannel = Channel<
+  Decay<Particle::B0, Particle::Mu,
+        Decay<Particle::Dst, Decay<Particle::D0, Particle::K, Particle::Pi>, Particle::PiSoft>>>;
+
+/// B0 -> D* mu nu, D* -> D0 pi_soft, D0 -> K pi pi pi
+using K3piChannel = Channel<
+  Decay<Particle::B0, Particle::Mu,
+        Decay<Particle::Dst, Decay<Particle::D0, Particle::K, Particle::Pi1, Particle::Pi2, Particle::Pi3>,
+              Particle::PiSoft>>,
+  Decay<Particle::B0, Particle::Mu,
+        Decay<Particle::Dst, Decay<Particle::D0, Particle::K, Particle::PiH, Particle::PiL, Particle::Pi3>,
+              Particle::PiSoft>>>;
+
+/// Every particle type, for the titles
+using KnownParticles = ParticleList<
+  Particle::B0, Particle::Dst, Particle::D0, Particle::Mu, Particle::K, Particle::PiSoft,
+  Particle::Pi, Particle::Pi1, Particle::Pi2, Particle::Pi3, Particle::PiH, Particle::PiL>;
@@ -0,0 +1,182 @@
+#include "EventJoin.hh" // Own include
+#include "Utils.hh"
+#include <TChain.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include <ROOT/TSeq.hxx>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+EventIndex::EventIndex(const vector<string>& files, TString name, int nThreads)
+{
+  // Entries of each file, and the entry of the chain of files it starts at
+  vector<Long64_t> offsets{0};
+  for (const auto& file : files) {
+    unique_ptr<TFile> f(TFile::Open(file.c_str()));
+    CHECKA(f && !f->IsZombie(), file);
+    TTree* t = f->Get<TTree>(name);
+    CHECKA(t, name + " is not a TTree (EventJoin does not read RNTuples)");
+    offsets.push_back(offsets.back() + t->GetEntries());
+  }
+
+  // Ranges of entries of each file, read by their own TTreeReader so that
+  // the entries are those of the chain (not rdfentry_, which only counts
+  // the entries in processing order with IMT)
+  typedef struct Task {
+    size_t iFile;
+    Long64_t begin, end;
+  } Task;
+  vector<Task> tasks;
+  for (size_t i = 0; i < files.size(); i++) {
+    const Long64_t n = offsets[i + 1] - offsets[i];
+    const Long64_t step = max<Long64_t>(1, (n + nThreads - 1) / nThreads);
+    for (Long64_t begin = 0; begin < n; begin += step)
+      tasks.push_back({i, begin, min(n, begin + step)});
+  }
+
+  // {key, entry} of every entry, per task, then sorted
+  vector<vector<pair<ULong64_t,Long64_t>>> parts(tasks.size());
+  if (!tasks.empty()) {
+    ROOT::TThreadExecutor pool(nThreads);
+    pool.Foreach([&](unsigned int iTask) {
+      const Task& task = tasks[iTask];
+      unique_ptr<TFile> f(TFile::Open(files[task.iFile].c_str()));
+      CHECKA(f && !f->IsZombie(), files[task.iFile]);
+      TTreeReader reader(name, f.get());
+      TTreeReaderValue<Int_t> exp(reader, "__experiment__"), run(reader, "__run__"), evt(reader, "__event__");
+      CHECKA(reader.SetEntriesRange(task.begin, task.end) == TTreeReader::kEntryValid, files[task.iFile]);
+      auto& part = parts[iTask];
+      part.reserve(task.end - task.begin);
+      while (reader.Next())
+        part.emplace_back(PackEventKey(*exp, *run, *evt), offsets[task.iFile] + reader.GetCurrentEntry());
+    }, ROOT::TSeqU(tasks.size()));
+  }
+
+  vector<pair<ULong64_t,Long64_t>> entries;
+  for (auto& part : parts) {
+    entries.insert(entries.end(), part.begin(), part.end());
+    part = {}; // Free the memory as soon as possible
+  }
+  sort(entries.begin(), entries.end());
+  m_nEntries = entries.size();
+
+  for (const auto& e : entries) {
+    if (!m_ranges.empty()) {
+      Range& last = m_ranges.back();
+      if (last.key == e.first && last.first + last.n == e.second) {
+        last.n++;
+        continue;
+      }
+    }
+    m_ranges.push_back({e.first, e.second, 1});
+  }
+  m_ranges.shrink_to_fit();
+}
+
+pair<const EventIndex::Range*, const EventIndex::Range*> EventIndex::Find(ULong64_t key) const
+{
+  auto cmp = [](const Range& r, ULong64_t k) { return r.key < k; };
+  auto begin = lower_bound(m_ranges.begin(), m_ranges.end(), key, cmp);
+  auto end = begin;
+  while (end != m_ranges.end() && end->key == key) ++end;
+  return {m_ranges.data() + (begin - m_ranges.begin()), m_ranges.data() + (end - m_ranges.begin())};
+}
+
+EventJoin::EventJoin(const vector<string>& files, TString recoName, TString mcName, int nThreads)
+: m_files(files), m_recoName(recoName), m_mcName(mcName),
+  m_recoIndex(files, recoName, nThreads), m_mcIndex(files, mcName, nThreads)
+{
+}
+
+/** Reads the given Double_t columns of a chain, entry by entry, checking
+ * that the entries belong to the event of their range of the index.
+ */
+class ChainReader {
+ public:
+  ChainReader(const vector<string>& files, TString name, const vector<TString>& columns)
+  : m_chain(name)
+  {
+    for (const auto& f : files)
+      m_chain.Add(f.c_str());
+    m_reader = make_unique<TTreeReader>(&m_chain);
+    m_exp = make_unique<TTreeReaderValue<Int_t>>(*m_reader, "__experiment__");
+    m_run = make_unique<TTreeReaderValue<Int_t>>(*m_reader, "__run__");
+    m_evt = make_unique<TTreeReaderValue<Int_t>>(*m_reader, "__event__");
+    for (const TString& col : columns)
+      m_values.push_back(make_unique<TTreeReaderValue<double>>(*m_reader, col));
+  }
+
+  /** Appends the columns of the entries of r to out. */
+  void Read(const EventIndex::Range& r, vector<double>& out)
+  {
+    for (Long64_t entry = r.first; entry < r.first + r.n; entry++) {
+      const TString where = m_chain.GetName() + TString::Format(" %lld", entry);
+      CHECKA(m_reader->SetEntry(entry) == TTreeReader::kEntryValid, where);
+      CHECKA(PackEventKey(**m_exp, **m_run, **m_evt) == r.key, where + " is not in the event of the index");
+      for (auto& v : m_values)
+        out.push_back(**v);
+    }
+  }
+
+ private:
+  TChain m_chain;
+  unique_ptr<TTreeReader> m_reader;
+  unique_ptr<TTreeReaderValue<Int_t>> m_exp, m_run, m_evt;
+  vector<unique_ptr<TTreeReaderValue<double>>> m_values;
+};
+
+void EventJoin::Run(int nThreads, const vector<TString>& recoColumns, const vector<TString>& mcColumns,
+                    const Action& action) const
+{
+  // The MC events, as their range of ranges in the MC index
+  const auto& mcRanges = m_mcIndex.GetRanges();
+  vector<pair<size_t,size_t>> events;
+  for (size_t i = 0; i < mcRanges.size();) {
+    size_t j = i + 1;
+    while (j < mcRanges.size() && mcRanges[j].key == mcRanges[i].key) j++;
+    events.emplace_back(i, j);
+    i = j;
+  }
+  if (events.empty()) return;
+
+  // Chunks of consecutive events, several per thread for load balancing
+  const size_t nChunks = min(events.size(), size_t(nThreads) * 4);
+  const size_t chunkSize = (events.size() + nChunks - 1) / nChunks;
+  mutex slotsMutex;
+  vector<unsigned int> freeSlots;
+  for (int i = nThreads - 1; i >= 0; i--)
+    freeSlots.push_back(i);
+
+  ROOT::TThreadExecutor pool(nThreads);
+  pool.Foreach([&](unsigned int iChunk) {
+    unsigned int iSlot;
+    {
+      lock_guard<mutex> lock(slotsMutex);
+      iSlot = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    ChainReader reco(m_files, m_recoName, recoColumns), mc(m_files, m_mcName, mcColumns);
+    JoinedEvent evt;
+    evt.m_nRecoCols = recoColumns.size();
+    evt.m_nMCCols = mcColumns.size();
+    const size_t end = min(events.size(), (iChunk + 1) * chunkSize);
+    for (size_t iEvt = iChunk * chunkSize; iEvt < end; iEvt++) {
+      evt.m_key = mcRanges[events[iEvt].first].key;
+      evt.m_mc.clear();
+      evt.m_reco.clear();
+      for (size_t i = events[iEvt].first; i < events[iEvt].second; i++)
+        mc.Read(mcRanges[i], evt.m_mc);
+      const auto recoRanges = m_recoIndex.Find(evt.m_key);
+      for (auto r = recoRanges.first; r != recoRanges.second; ++r)
+        reco.Read(*r, evt.m_reco);
+      action(iSlot, evt);
+    }
+    lock_guard<mutex> lock(slotsMutex);
+    freeSlots.push_back(iSlot);
+  }, ROOT::TSeqU(nChunks));
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <TString.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Packs an event identifier in a 64-bit key that sorts like (exp, run, evt). */
+inline ULong64_t PackEventKey(Int_t exp, Int_t run, Int_t evt)
+{
+  return (ULong64_t(UShort_t(exp)) << 48) | (ULong64_t(UShort_t(run)) << 32) | UInt_t(evt);
+}
+
+/** Pseudo-random number in [0, 1) fixed by the event identifier, the same
+ * in all the trees of an ntuple (splitmix64 of PackEventKey).
+ */
+inline double EventSampleValue(Int_t exp, Int_t run, Int_t evt)
+{
+  ULong64_t x = PackEventKey(exp, run, evt);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return (x >> 11) / 9007199254740992.0; // 2^53
+}
+
+/** Compact index of an ntuple: the ranges of consecutive entries of each
+ * event, sorted by event key.
+ */
+class EventIndex {
+ public:
+  typedef struct Range {
+    ULong64_t key;  /**< PackEventKey(exp, run, evt). */
+    Long64_t first; /**< First entry of the range. */
+    UInt_t n;       /**< Number of consecutive entries. */
+  } Range;
+
+  EventIndex() = delete;
+  EventIndex(const EventIndex&) = delete;
+  EventIndex(EventIndex&&) = delete;
+  EventIndex& operator=(const EventIndex&) = delete;
+  EventIndex& operator=(EventIndex&&) = delete;
+
+  /** Builds the index of the TTree name of files, with one parallel pass
+   * on the event identifier columns only. The entries are those of the
+   * TChain of files.
+   */
+  EventIndex(const std::vector<std::string>& files, TString name, int nThreads);
+
+  /** Returns the ranges [begin, end) of the event key (empty if the event
+   * is not in the ntuple). There is more than one range only if the entries
+   * of the event are not consecutive.
+   */
+  std::pair<const Range*, const Range*> Find(ULong64_t key) const;
+
+  const std::vector<Range>& GetRanges() const { return m_ranges; }
+  ULong64_t GetNEntries() const { return m_nEntries; }
+
+ private:
+  std::vector<Range> m_ranges; /**< Sorted by key, then by first entry. */
+  ULong64_t m_nEntries = 0;
+};
+
+/** The rows of one event in two joined ntuples, with the requested columns
+ * (in the order they were requested) read as double.
+ */
+class JoinedEvent {
+ public:
+  ULong64_t GetKey() const { return m_key; }
+  size_t NReco() const { return m_nRecoCols ? m_reco.size() / m_nRecoCols : 0; }
+  double Reco(size_t row, size_t col) const { return m_reco[row * m_nRecoCols + col]; }
+  size_t NMC() const { return m_nMCCols ? m_mc.size() / m_nMCCols : 0; }
+  double MC(size_t row, size_t col) const { return m_mc[row * m_nMCCols + col]; }
+
+ private:
+  friend class EventJoin;
+  ULong64_t m_key = 0;
+  size_t m_nRecoCols = 0, m_nMCCols = 0;
+  std::vector<double> m_reco, m_mc; /**< Row-major, reused from one event to the next. */
+};
+
+/** Joins a reconstructed ntuple (e.g. Kpi) with its MC truth ntuple (e.g.
+ * MCKpi) by event, so that the candidates can be compared with the true
+ * particles they come from.
+ *
+ * Both ntuples are indexed in parallel by EventIndex (by ranges of entries
+ * of each file); then the events are split in chunks, and each chunk is read
+ * by its own TTreeReaders (only the requested columns, in entry order, with
+ * a check of the event identifiers), so neither ntuple is ever loaded in
+ * memory. The ntuples must be TTrees whose requested columns are Double_t
+ * (the basf2 ntuples, not the converted RNTuples).
+ */
+class EventJoin {
+ public:
+  /** Called for each event, concurrently, with a slot < the number of threads. */
+  typedef std::function<void(unsigned int, const JoinedEvent&)> Action;
+
+  EventJoin() = delete;
+  EventJoin(const EventJoin&) = delete;
+  EventJoin(EventJoin&&) = delete;
+  EventJoin& operator=(const EventJoin&) = delete;
+  EventJoin& operator=(EventJoin&&) = delete;
+
+  /** Indexes the ntuples recoName and mcName of files, with nThreads threads. */
+  EventJoin(const std::vector<std::string>& files, TString recoName, TString mcName, int nThreads);
+
+  /** Streams every event of the MC ntuple to action, with the rows of the
+   * same event of the reco ntuple (none if nothing was reconstructed).
+   * @param nThreads Number of threads, and of slots passed to action
+   */
+  void Run(int nThreads, const std::vector<TString>& recoColumns, const std::vector<TString>& mcColumns,
+           const Action& action) const;
+
+  const EventIndex& GetRecoIndex() const { return m_recoIndex; }
+  const EventIndex& GetMCIndex() const { return m_mcIndex; }
+
+ private:
+  std::vector<std::string> m_files;
+  TString m_recoName;
+  TString m_mcName;
+  EventIndex m_recoIndex;
+  EventIndex m_mcIndex;
+};
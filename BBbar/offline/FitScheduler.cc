@@ -0,0 +1,141 @@
+#include "FitScheduler.hh" // Own include
+#include "Utils.hh"
+#include <TF1.h>
+#include <TH1.h>
+#include <TDirectory.h>
+#include <TTree.h>
+#include <TMath.h>
+#include <Fit/Fitter.h>
+#include <Fit/BinData.h>
+#include <Fit/DataRange.h>
+#include <HFitInterface.h>
+#include <Math/WrappedMultiTF1.h>
+#include <Math/Factory.h>
+#include <Math/Minimizer.h>
+#include <Math/IntegratorOptions.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include <string>
+using namespace std;
+
+FitScheduler::~FitScheduler() = default;
+
+void FitScheduler::Schedule(TH1* h, TString func, const vector<pair<TString,double>>& p0)
+{
+  CHECK(h);
+  CHECKA(!m_byName.count(h->GetName()), "already scheduled: "TS + h->GetName());
+  auto req = make_unique<FitRequest>();
+  req->histo = h;
+  req->func = func;
+  // Created (and compiled) here, so the worker threads never use the interpreter
+  req->tf1 = make_unique<TF1>(h->GetName() + "_fit"TS, func, h->GetBinLowEdge(1),
+                              h->GetBinLowEdge(h->GetNbinsX() + 1), TF1::EAddToList::kNo);
+  TF1& f = *req->tf1;
+
+  int nSigma = 0, nNorm = 0;
+  for (int i = 0; i < f.GetNpar(); i++) {
+    const TString name = f.GetParName(i);
+    if (name == "mu")
+      f.SetParameter(i, h->GetMean());
+    else if (name.BeginsWith("sigma"))
+      f.SetParameter(i, h->GetRMS() * (nSigma++ == 0 ? 0.5 : 2.0)); // Start the Gaussians apart
+    else if (name.BeginsWith("N"))
+      f.SetParameter(i, h->GetMaximum() * (nNorm++ == 0 ? 1.0 : 0.1));
+  }
+  for (const auto& pp0 : p0)
+    f.SetParameter(pp0.first, pp0.second);
+
+  m_byName[h->GetName()] = req.get();
+  m_requests.push_back(move(req));
+}
+
+void FitScheduler::Fit(FitRequest& req)
+{
+  TF1& f = *req.tf1;
+  req.done = true;
+  if (req.histo->GetEntries() <= f.GetNpar()) return; // Nothing to fit
+
+  ROOT::Fit::DataOptions opt;
+  opt.fIntegral = true; // Like the "I" option of TH1::Fit
+  ROOT::Fit::DataRange range(f.GetXmin(), f.GetXmax());
+  ROOT::Fit::BinData data(opt, range);
+  ROOT::Fit::FillData(data, req.histo, &f);
+
+  ROOT::Math::WrappedMultiTF1 wf(f, 1);
+  ROOT::Fit::Fitter fitter;
+  fitter.Config().SetMinimizer("Minuit2", "Migrad");
+  fitter.SetFunction(wf);
+  const bool ok = fitter.Fit(data);
+
+  const auto& res = fitter.Result();
+  req.result.status = ok ? res.Status() : TMath::Max(res.Status(), 1);
+  req.result.chi2 = res.Chi2();
+  req.result.ndf = res.Ndf();
+  req.result.pars = res.Parameters();
+  req.result.errors = res.Errors();
+  f.SetParameters(req.result.pars.data());
+  f.SetParErrors(req.result.errors.data());
+  f.SetChisquare(req.result.chi2);
+  f.SetNDF(req.result.ndf);
+}
+
+void FitScheduler::RunAll(int nThreads)
+{
+  vector<FitRequest*> todo;
+  for (auto& req : m_requests)
+    if (!req->done) todo.push_back(req.get());
+  if (todo.empty()) return;
+
+  // Load the plugins now, plugin loading is not thread safe. The bin
+  // integrals use the Gauss integrator, which needs no plugin.
+  delete ROOT::Math::Factory::CreateMinimizer("Minuit2", "Migrad");
+  ROOT::Math::IntegratorOneDimOptions::SetDefaultIntegrator("Gauss");
+
+  ROOT::TThreadExecutor pool(nThreads);
+  pool.Foreach([](FitRequest* req) { Fit(*req); }, todo);
+}
+
+FitScheduler::FitRequest* FitScheduler::Find(const TH1* h) const
+{
+  if (!h) return nullptr;
+  auto it = m_byName.find(h->GetName());
+  return it != m_byName.end() && it->second->histo == h ? it->second : nullptr;
+}
+
+TF1* FitScheduler::GetFunction(const TH1* h) const
+{
+  FitRequest* req = Find(h);
+  return req ? req->tf1.get() : nullptr;
+}
+
+const FitResult* FitScheduler::GetResult(const TH1* h) const
+{
+  FitRequest* req = Find(h);
+  return req ? &req->result : nullptr;
+}
+
+void FitScheduler::Write(TDirectory* dir) const
+{
+  string histo, func;
+  FitResult result;
+  vector<string> parNames;
+  TTree t("fits", "Fit results");
+  t.SetDirectory(nullptr);
+  t.Branch("histo", &histo);
+  t.Branch("func", &func);
+  t.Branch("status", &result.status);
+  t.Branch("chi2", &result.chi2);
+  t.Branch("ndf", &result.ndf);
+  t.Branch("parNames", &parNames);
+  t.Branch("pars", &result.pars);
+  t.Branch("errors", &result.errors);
+  for (const auto& req : m_requests) {
+    histo = req->histo->GetName();
+    func = req->func.Data();
+    result = req->result;
+    parNames.clear();
+    for (int i = 0; i < req->tf1->GetNpar(); i++)
+      parNames.push_back(req->tf1->GetParName(i));
+    t.Fill();
+  }
+  dir->WriteTObject(&t);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <TString.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// Forward declarations
+class TH1;
+class TF1;
+class TDirectory;
+
+/** The result of a scheduled fit (a copy of what is in the TF1). */
+typedef struct FitResult {
+  int status = -1; /**< 0 if the fit converged, -1 if it did not run. */
+  double chi2 = 0;
+  int ndf = 0;
+  std::vector<double> pars;
+  std::vector<double> errors;
+} FitResult;
+
+/** Collects fit requests, then runs them all concurrently on a thread pool.
+ *
+ * Each request owns its own TF1 (created when it is scheduled, on the
+ * calling thread), so the fits do not share any function object; the
+ * minimizer (Minuit2) is created by each fit too. The fitted TF1s are kept
+ * for drawing.
+ */
+class FitScheduler {
+ public:
+  FitScheduler(const FitScheduler&) = delete;
+  FitScheduler(FitScheduler&&) = delete;
+  FitScheduler& operator=(const FitScheduler&) = delete;
+  FitScheduler& operator=(FitScheduler&&) = delete;
+
+  FitScheduler() = default;
+  ~FitScheduler();
+
+  /** Schedules a (chi2, bin integral) fit of h with func over the whole
+   * histogram range. Parameters called mu, sigma*, and N* that are not in p0
+   * are initialized from the mean, RMS and maximum of h. A histogram (name)
+   * can only be scheduled once.
+   * @param p0 is a list of {param_name, initial_value} pairs
+   */
+  void Schedule(TH1* h, TString func, const std::vector<std::pair<TString,double>>& p0 = {});
+
+  /** Runs all the fits scheduled and not run yet.
+   * @param nThreads Number of threads of the pool
+   */
+  void RunAll(int nThreads);
+
+  /** Returns the fitted function of h, or nullptr if h was not scheduled. */
+  TF1* GetFunction(const TH1* h) const;
+
+  /** Returns the result of the fit of h, or nullptr if h was not scheduled. */
+  const FitResult* GetResult(const TH1* h) const;
+
+  /** Writes all the results to dir as a TTree called "fits", with one entry
+   * per fit (histogram name, function, status, chi2, ndf and parameters).
+   */
+  void Write(TDirectory* dir) const;
+
+ private:
+  typedef struct FitRequest {
+    TH1* histo;
+    TString func;
+    std::unique_ptr<TF1> tf1;
+    FitResult result;
+    bool done = false;
+  } FitRequest;
+
+  /** Fits a single request (called concurrently). */
+  static void Fit(FitRequest& req);
+
+  /** Returns the request of h, or nullptr if h was not scheduled. */
+  FitRequest* Find(const TH1* h) const;
+
+  std::vector<std::unique_ptr<FitRequest>> m_requests; /**< In the order they were scheduled. */
+  std::unordered_map<std::string, FitRequest*> m_byName; /**< By histogram name. */
+};
@@ -0,0 +1,65 @@
+#include "HistoRegistry.hh" // Own include
+#include "Constants.hh"
+#include "Utils.hh"
+#include <functional>
+using namespace std;
+
+size_t HistoKeyHash::operator()(const HistoKey& k) const
+{
+  size_t h = k.particle.Hash();
+  auto combine = [&h](size_t v) { h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+  combine(k.variable.Hash());
+  combine(size_t(k.kind));
+  combine(hash<int>()(k.xBins));
+  combine(hash<double>()(k.xLow));
+  combine(hash<double>()(k.xUp));
+  combine(hash<int>()(k.yBins));
+  combine(hash<double>()(k.yLow));
+  combine(hash<double>()(k.yUp));
+  return h;
+}
+
+/** Splits "p_var" in {"p", "var"} if p is a particle, else returns {"", "p_var"}. */
+static pair<TString,TString> SplitParticle(const TString& variable)
+{
+  const Ssiz_t i = variable.First('_');
+  if (i > 0) {
+    const TString p = variable(0, i);
+    if (ParticlesTitles.count(p))
+      return {p, variable(i + 1, variable.Length() - i - 1)};
+  }
+  return {"", variable};
+}
+
+HistoKey MakeHistoKey(HistoKind kind, TString variable, TString vy,
+                      int xBins, double xLow, double xUp, int yBins, double yLow, double yUp)
+{
+  auto px = SplitParticle(variable);
+  if (vy.IsNull())
+    return {px.first, px.second, kind, xBins, xLow, xUp, 0, 0, 0};
+  auto py = SplitParticle(vy);
+  // Same particle on both axes (the usual case) or none at all
+  if (px.first == py.first)
+    return {px.first, px.second + ":" + py.second, kind, xBins, xLow, xUp, yBins, yLow, yUp};
+  return {"", variable + ":" + vy, kind, xBins, xLow, xUp, yBins, yLow, yUp};
+}
+
+void HistoRegistry::Add(const HistoKey& key, TString name, size_t index)
+{
+  const size_t i = m_entries.size();
+  CHECKA(m_byName.emplace(name.Data(), i).second, name);
+  m_byKey.emplace(key, i);
+  m_entries.push_back({key, name, index});
+}
+
+const HistoRegistry::Entry* HistoRegistry::Find(const TString& name) const
+{
+  auto it = m_byName.find(name.Data());
+  return it == m_byName.end() ? nullptr : &m_entries[it->second];
+}
+
+const HistoRegistry::Entry* HistoRegistry::Find(const HistoKey& key) const
+{
+  auto it = m_byKey.find(key);
+  return it == m_byKey.end() ? nullptr : &m_entries[it->second];
+}
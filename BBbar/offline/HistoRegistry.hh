@@ -0,0 +1,77 @@
+#pragma once
+#include <TString.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** The kind of a booked histogram (pair). */
+enum class HistoKind { H1, H2, Eff, Purity };
+
+/** Structured key of a histogram booked by a plotter. The channel and the
+ * stage (cuts, best candidate, ...) are those of the plotter, which owns
+ * its registry.
+ */
+typedef struct HistoKey {
+  TString particle; /**< "" for the event variables (e.g. massDiff). */
+  TString variable; /**< Without the particle, e.g. "d0Residual" (2D: "mcPT:d0Residual"). */
+  HistoKind kind;
+  int xBins; double xLow, xUp;
+  int yBins; double yLow, yUp; /**< Only for HistoKind::H2. */
+
+  bool operator==(const HistoKey& o) const
+  {
+    return particle == o.particle && variable == o.variable && kind == o.kind &&
+           xBins == o.xBins && xLow == o.xLow && xUp == o.xUp &&
+           yBins == o.yBins && yLow == o.yLow && yUp == o.yUp;
+  }
+} HistoKey;
+
+/** Hash of HistoKey, for the unordered containers. */
+struct HistoKeyHash {
+  size_t operator()(const HistoKey& k) const;
+};
+
+/** Returns the key of a histogram of variable (with the particle prefix, as
+ * booked). vy is empty for the 1D histograms.
+ */
+HistoKey MakeHistoKey(HistoKind kind, TString variable, TString vy,
+                      int xBins, double xLow, double xUp, int yBins = 0, double yLow = 0, double yUp = 0);
+
+/** Index of the histograms booked by a plotter, with O(1) lookup by name (of
+ * the first histogram of the pair) or by structured key. The histograms
+ * themselves stay in the plotter, the registry only keeps where they are.
+ */
+class HistoRegistry {
+ public:
+  typedef struct Entry {
+    HistoKey key;
+    TString name; /**< Name of the first histogram of the pair (sig, effSig, ...). */
+    size_t index; /**< Index in the plotter's list of this kind. */
+  } Entry;
+
+  HistoRegistry(const HistoRegistry&) = delete;
+  HistoRegistry(HistoRegistry&&) = delete;
+  HistoRegistry& operator=(const HistoRegistry&) = delete;
+  HistoRegistry& operator=(HistoRegistry&&) = delete;
+
+  HistoRegistry() = default;
+
+  /** Registers a histogram. Names must be unique; if a key is registered
+   * twice, lookups by key return the first one.
+   */
+  void Add(const HistoKey& key, TString name, size_t index);
+
+  /** Returns the entry with the given name, or nullptr. */
+  const Entry* Find(const TString& name) const;
+
+  /** Returns the entry with the given key, or nullptr. */
+  const Entry* Find(const HistoKey& key) const;
+
+  /** All the entries, in booking order. */
+  const std::vector<Entry>& GetEntries() const { return m_entries; }
+
+ private:
+  std::vector<Entry> m_entries;
+  std::unordered_map<std::string, size_t> m_byName; /**< Index in m_entries. */
+  std::unordered_map<HistoKey, size_t, HistoKeyHash> m_byKey; /**< Index in m_entries. */
+};
@@ -0,0 +1,93 @@
+#include "InputPipeline.hh" // Own include
+#include <TEnv.h>
+#include <TTreeCacheUnzip.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+/** Entries of a slot between two samples of the clocks. */
+static const ULong64_t SampleEvery = 64;
+
+/** Above this fraction of waiting, the loop is reported as input bound. */
+static const double InputBoundFraction = 0.5;
+
+void ConfigureInput(double readAhead, bool prefetch)
+{
+  // TTree::GetCacheAutoSize multiplies the cluster size by this factor. The
+  // cache only holds the branches read during its learning phase, i.e. those
+  // used by the graph
+  gEnv->SetValue("TTreeCache.Size", readAhead);
+  if (!prefetch) return;
+  // A thread of each file reads the next blocks while the current ones are
+  // processed, and the baskets in the cache are unzipped by parallel tasks
+  gEnv->SetValue("TFile.AsyncPrefetching", 1);
+  TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kEnable);
+}
+
+/** CPU time of the calling thread, in seconds. */
+static double ThreadCPUTime()
+{
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static atomic<ULong64_t> NextMonitorId {1};
+
+IOMonitor::IOMonitor(ROOT::RDF::RNode df, TString name)
+: m_name(name), m_id(NextMonitorId++), m_slots(df.GetNSlots())
+{
+  // Always true, the Count keeps the filter in the loop
+  m_count = df.Filter([this](unsigned int slot) { Sample(slot); return true; }, {"rdfslot_"}).Count();
+}
+
+void IOMonitor::Sample(unsigned int slot)
+{
+  // Last sample of this thread: the time between two samples goes to the slot
+  // of the second one, so that the start of the tasks (opening the files,
+  // filling the caches) is counted too
+  thread_local ULong64_t lastMonitor = 0;
+  thread_local unsigned int lastSlot = 0;
+  thread_local chrono::steady_clock::time_point lastWall;
+  thread_local double lastCPU = 0;
+
+  SlotTimes& s = m_slots[slot];
+  s.entries++;
+  const bool sameMonitor = lastMonitor == m_id;
+  if (sameMonitor && lastSlot == slot && s.entries % SampleEvery != 0) return;
+  const auto wall = chrono::steady_clock::now();
+  const double cpu = ThreadCPUTime();
+  if (sameMonitor) {
+    s.wall += chrono::duration<double>(wall - lastWall).count();
+    s.cpu += cpu - lastCPU;
+  }
+  lastMonitor = m_id;
+  lastSlot = slot;
+  lastWall = wall;
+  lastCPU = cpu;
+}
+
+void IOMonitor::Print() const
+{
+  if (!m_count.IsReady()) return; // No loop yet
+  TString fs;
+  SlotTimes total;
+  cout << "Input of " << m_name << " (" << m_slots.size() << " slots)" << endl;
+  cout << "   Slot       Entries    Wall [s]     CPU [s]   Waiting" << endl;
+  for (size_t i = 0; i < m_slots.size(); i++) {
+    const SlotTimes& s = m_slots[i];
+    fs.Form("   %4zu  %12llu  %10.2f  %10.2f  %7.1f%%", i, s.entries, s.wall, s.cpu,
+            s.wall == 0 ? 0.0 : 100.0 * (1 - s.cpu / s.wall));
+    cout << fs << endl;
+    total.entries += s.entries;
+    total.wall += s.wall;
+    total.cpu += s.cpu;
+  }
+  const double waiting = total.wall == 0 ? 0.0 : 1 - total.cpu / total.wall;
+  fs.Form("   Total %12llu  %10.2f  %10.2f  %7.1f%%", total.entries, total.wall, total.cpu, 100 * waiting);
+  cout << fs << endl;
+  cout << "   " << (waiting > InputBoundFraction ? "Input bound: more threads would not help"
+                                                 : "CPU bound: more threads could help") << endl;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <TString.h>
+#include <ROOT/RDataFrame.hxx>
+#include <vector>
+
+/** Configures how the event loops read the trees, before the files are
+ * opened (all the following dataframes).
+ * @param readAhead Clusters held by the TTreeCache of each task
+ * @param prefetch Read the next blocks of the files in a background thread and
+ *        unzip the baskets of the caches in parallel tasks
+ */
+void ConfigureInput(double readAhead, bool prefetch);
+
+/** Measures, per slot of the first event loop of a dataframe, the time spent
+ * computing (CPU time of the thread, decompression included) and waiting
+ * (the rest of the wall time: reads and scheduling). If the slots are mostly
+ * waiting, more threads would not help.
+ */
+class IOMonitor {
+ public:
+  IOMonitor() = delete;
+  IOMonitor(const IOMonitor&) = delete;
+  IOMonitor(IOMonitor&&) = delete;
+  IOMonitor& operator=(const IOMonitor&) = delete;
+  IOMonitor& operator=(IOMonitor&&) = delete;
+
+  /** Books the measurement on the first loop over df (lazy). */
+  IOMonitor(ROOT::RDF::RNode df, TString name);
+
+  /** Prints a line per slot and the total (after the loop). */
+  void Print() const;
+
+ private:
+  typedef struct alignas(64) SlotTimes { // One cache line each, written by one thread
+    ULong64_t entries = 0;
+    double wall = 0; /**< Seconds. */
+    double cpu = 0;  /**< Seconds. */
+  } SlotTimes;
+
+  /** Called on each entry, accumulates the times since the previous sample
+   * of the thread.
+   */
+  void Sample(unsigned int slot);
+
+  TString m_name;
+  ULong64_t m_id; /**< Unique, to tell the monitors apart in the threads. */
+  std::vector<SlotTimes> m_slots;
+  ROOT::RDF::RResultPtr<ULong64_t> m_count;
+};
@@ -0,0 +1,313 @@
+#include "JitCache.hh" // Own include
+#include "Constants.hh"
+#include "Utils.hh"
+#include <TMD5.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+/** An expression of the cache. */
+typedef struct JitEntry {
+  TString kind;       /**< "Define", "Filter", "Histo1D" or "Histo2D". */
+  TString expression; /**< For the histograms, the columns. */
+  vector<TString> columns;
+  vector<TString> types; /**< Of the columns. */
+  TString symbol;        /**< Of the compiled function and of its library, from the hash. */
+} JitEntry;
+
+typedef ROOT::RDF::RNode* (*NodeFunction)(ROOT::RDF::RNode*, const char*);
+typedef ROOT::RDF::RResultPtr<TH1D>* (*Histo1DFunction)(ROOT::RDF::RNode*, const ROOT::RDF::TH1DModel*);
+typedef ROOT::RDF::RResultPtr<TH2D>* (*Histo2DFunction)(ROOT::RDF::RNode*, const ROOT::RDF::TH2DModel*);
+
+static TString CacheDir; // Empty if no cache is open
+static map<TString,void*> Libraries; // By symbol
+static map<TString,JitEntry> Misses; // By symbol
+static ULong64_t Hits = 0;
+static mutex CacheMutex; // Plotters may be booked concurrently
+
+static TString Md5(const TString& s)
+{
+  TMD5 md5;
+  md5.Update((const UChar_t*)s.Data(), s.Length());
+  md5.Final();
+  return md5.AsString();
+}
+
+/** Hash of the ROOT version, part of the hash of each expression. */
+static TString RootHash()
+{
+  return Md5(TString(gROOT->GetVersion()) + " " + gROOT->GetGitCommit())(0, 8);
+}
+
+/** Returns the path of the files of the expression of symbol, without
+ * extension: the library (.so), its source (.cxx), and the lock (.lock) or
+ * the compiler output (.failed) of SaveJitCache.
+ */
+static TString EntryPath(const TString& symbol)
+{
+  return CacheDir + "/" + symbol;
+}
+
+/** Returns the library of symbol, loaded if needed, or nullptr if it does not
+ * exist or cannot be loaded (with a message).
+ */
+static void* LoadLibrary(const TString& symbol)
+{
+  auto it = Libraries.find(symbol);
+  if (it != Libraries.end()) return it->second;
+  const TString path = EntryPath(symbol) + ".so";
+  if (gSystem->AccessPathName(path)) return nullptr; // Returns true if it does NOT exist
+  void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!lib)
+    cout << "Ignoring " << path << ": " << dlerror() << endl;
+  Libraries[symbol] = lib;
+  return lib;
+}
+
+void OpenJitCache(TString dir)
+{
+  if (gSystem->AccessPathName(dir)) // Returns true if it does NOT exist
+    CHECKA(gSystem->mkdir(dir, true) == 0, "cannot create " + dir);
+  CacheDir = dir;
+}
+
+/** Returns the columns of df read by expression, as RDataFrame finds them:
+ * the identifiers that are column names, except the members (after "." or
+ * "->") and the qualified names (after "::"). The expression is split into
+ * tokens, so that literals and numbers are skipped, and "a>b" or "c?x:y"
+ * read a, b, c, x and y.
+ */
+static vector<TString> ExpressionColumns(ROOT::RDF::RNode& df, const TString& expression)
+{
+  vector<TString> res;
+  const char* s = expression.Data();
+  const Ssiz_t n = expression.Length();
+  TString previous; // Token
+  for (Ssiz_t i = 0; i < n;) {
+    const char c = s[i];
+    if (isspace(c)) { i++; continue; }
+    const Ssiz_t begin = i;
+    if (c == '"' || c == '\'') { // Literal
+      for (i++; i < n && s[i] != c; i++)
+        if (s[i] == '\\') i++;
+      i = min(i + 1, n);
+    } else if (isdigit(c) || (c == '.' && i + 1 < n && isdigit(s[i + 1]))) { // Number, e.g. .5, 1e-3 or 7u
+      for (i++; i < n; i++)
+        if (!isalnum(s[i]) && s[i] != '_' && s[i] != '.' && !(strchr("+-", s[i]) && strchr("eEpP", s[i - 1])))
+          break;
+    } else if (isalpha(c) || c == '_') { // Identifier
+      while (i < n && (isalnum(s[i]) || s[i] == '_')) i++;
+      TString word = expression(begin, i - begin);
+      if (previous != "." && previous != "->" && previous != "::" &&
+          find(res.begin(), res.end(), word) == res.end() && df.HasColumn(word.Data()))
+        res.push_back(word);
+    } else { // Punctuator: only "->" and "::" matter
+      const bool twoChars = i + 1 < n && ((c == '-' && s[i + 1] == '>') || (c == ':' && s[i + 1] == ':'));
+      i += twoChars ? 2 : 1;
+    }
+    previous = expression(begin, i - begin);
+  }
+  return res;
+}
+
+/** Returns the compiled function of the entry, or nullptr (a miss, to be
+ * compiled by SaveJitCache).
+ */
+static void* Lookup(ROOT::RDF::RNode& df, JitEntry& e)
+{
+  TString text = RootHash() + "\n" + e.kind + "\n" + e.expression;
+  for (const auto& c : e.columns) {
+    e.types.push_back(df.GetColumnType(c.Data()));
+    text += "\n" + c + " " + e.types.back();
+  }
+  e.symbol = "AnaJit_" + Md5(text);
+
+  lock_guard<mutex> lock(CacheMutex);
+  if (void* lib = LoadLibrary(e.symbol)) {
+    if (void* f = dlsym(lib, e.symbol)) {
+      Hits++;
+      return f;
+    }
+  }
+  Misses.emplace(e.symbol, e);
+  return nullptr;
+}
+
+/** Takes ownership of p, allocated by a compiled function, and returns a copy. */
+template <class T>
+static T Own(T* p)
+{
+  unique_ptr<T> owner(p);
+  return *owner;
+}
+
+ROOT::RDF::RNode CachedDefine(ROOT::RDF::RNode df, TString name, TString expression)
+{
+  if (!CacheDir.IsNull()) {
+    JitEntry e{"Define", expression, ExpressionColumns(df, expression), {}, ""};
+    if (auto f = (NodeFunction)Lookup(df, e))
+      return Own(f(&df, name.Data()));
+  }
+  return df.Define(name.Data(), expression.Data());
+}
+
+ROOT::RDF::RNode CachedFilter(ROOT::RDF::RNode df, TString expression, TString filterName)
+{
+  if (!CacheDir.IsNull()) {
+    JitEntry e{"Filter", expression, ExpressionColumns(df, expression), {}, ""};
+    if (auto f = (NodeFunction)Lookup(df, e))
+      return Own(f(&df, filterName.Data()));
+  }
+  return df.Filter(expression.Data(), filterName.Data());
+}
+
+ROOT::RDF::RResultPtr<TH1D> CachedHisto1D(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel& model,
+                                          TString column)
+{
+  if (!CacheDir.IsNull()) {
+    JitEntry e{"Histo1D", column, {column}, {}, ""};
+    if (auto f = (Histo1DFunction)Lookup(df, e))
+      return Own(f(&df, &model));
+  }
+  return df.Histo1D(model, column.Data());
+}
+
+ROOT::RDF::RResultPtr<TH2D> CachedHisto2D(ROOT::RDF::RNode df, const ROOT::RDF::TH2DModel& model,
+                                          TString columnX, TString columnY)
+{
+  if (!CacheDir.IsNull()) {
+    JitEntry e{"Histo2D", columnX + " " + columnY, {columnX, columnY}, {}, ""};
+    if (auto f = (Histo2DFunction)Lookup(df, e))
+      return Own(f(&df, &model));
+  }
+  return df.Histo2D(model, columnX.Data(), columnY.Data());
+}
+
+/** Returns the source of the compiled function of e: the same lambda as the
+ * one RDataFrame jits, with the column types of the hash.
+ */
+static TString EntrySource(const JitEntry& e)
+{
+  TString params, names;
+  for (size_t i = 0; i < e.columns.size(); i++) {
+    params += (i ? ", const " : "const ") + e.types[i] + "& " + e.columns[i];
+    names += (i ? ", \"" : "\"") + e.columns[i] + "\"";
+  }
+  TString res = "// " + e.kind + ": " + e.expression + "\nextern \"C\" ";
+  if (e.kind == "Define" || e.kind == "Filter") {
+    res += "ROOT::RDF::RNode* " + e.symbol + "(ROOT::RDF::RNode* df, const char* name)\n{\n";
+    if (e.kind == "Define")
+      res += "  return new ROOT::RDF::RNode(df->Define(name, [](" + params + ") { return (" + e.expression +
+             "); }, {" + names + "}));\n}\n";
+    else
+      res += "  return new ROOT::RDF::RNode(df->Filter([](" + params + ") -> bool { return (" + e.expression +
+             "); }, {" + names + "}, name));\n}\n";
+  } else if (e.kind == "Histo1D") {
+    res += "ROOT::RDF::RResultPtr<TH1D>* " + e.symbol +
+           "(ROOT::RDF::RNode* df, const ROOT::RDF::TH1DModel* model)\n{\n"
+           "  return new ROOT::RDF::RResultPtr<TH1D>(df->Histo1D<" + e.types[0] + ">(*model, " + names + "));\n}\n";
+  } else {
+    res += "ROOT::RDF::RResultPtr<TH2D>* " + e.symbol +
+           "(ROOT::RDF::RNode* df, const ROOT::RDF::TH2DModel* model)\n{\n"
+           "  return new ROOT::RDF::RResultPtr<TH2D>(df->Histo2D<" + e.types[0] + ", " + e.types[1] +
+           ">(*model, " + names + "));\n}\n";
+  }
+  return res;
+}
+
+/** Takes the lock of the library of symbol, so that the jobs that share the
+ * cache directory compile it once. Returns false if another job holds it
+ * (for less than JitCacheLockTimeout seconds), or if the library was already
+ * compiled, or failed to.
+ */
+static bool LockEntry(const TString& symbol)
+{
+  const TString path = EntryPath(symbol);
+  if (!gSystem->AccessPathName(path + ".so") || !gSystem->AccessPathName(path + ".failed"))
+    return false;
+  FileStat_t st;
+  if (gSystem->GetPathInfo(path + ".lock", st) == 0 && time(nullptr) - st.fMtime > JitCacheLockTimeout)
+    gSystem->Unlink(path + ".lock"); // Left by a killed job
+  const int fd = open(path + ".lock", O_CREAT | O_EXCL | O_WRONLY, 0644);
+  if (fd < 0) return false;
+  close(fd);
+  return true;
+}
+
+/** Compiles the library of e alone (its lock being held), then releases the
+ * lock. If it fails, the compiler output is kept in the .failed file and the
+ * expression is jitted by the next runs too. Returns true on success.
+ */
+static bool CompileEntry(const JitEntry& e)
+{
+  const TString path = EntryPath(e.symbol);
+  {
+    ofstream ofs((path + ".cxx").Data());
+    ofs << "// Generated by ana (JitCache.cc) for ROOT " << gROOT->GetVersion() << "\n"
+        << "#include <ROOT/RDataFrame.hxx>\n#include <ROOT/RVec.hxx>\n#include <TMath.h>\n"
+        << "#include <TH1D.h>\n#include <TH2D.h>\n#include <algorithm>\n#include <cmath>\n"
+        << "using namespace std;\nusing namespace ROOT::VecOps;\n\n" << EntrySource(e);
+    CHECKA(ofs.good(), path + ".cxx");
+  }
+
+  // Built aside then renamed, for the jobs that load the libraries meanwhile
+  const TString tmp = TString::Format("%s.so.%d", path.Data(), gSystem->GetPid());
+  const TString cmd = TString::Format("%s %s.cxx $(root-config --cflags --libs) -o %s > %s.log 2>&1",
+                                      JitCacheCompiler.Data(), path.Data(), tmp.Data(), path.Data());
+  const bool ok = gSystem->Exec(cmd) == 0 && gSystem->Rename(tmp, path + ".so") == 0;
+  if (ok) {
+    gSystem->Unlink(path + ".log");
+  } else {
+    gSystem->Unlink(tmp);
+    gSystem->Rename(path + ".log", path + ".failed");
+  }
+  gSystem->Unlink(path + ".lock");
+  return ok;
+}
+
+TString SaveJitCache()
+{
+  if (CacheDir.IsNull()) return "";
+  lock_guard<mutex> lock(CacheMutex);
+  TString summary = TString::Format("JIT cache %s: %llu compiled expressions, %zu jitted",
+                                    CacheDir.Data(), Hits, Misses.size());
+  if (Misses.empty()) return summary;
+
+  // Each expression in its own library: one that does not compile is only
+  // jitted, the others are compiled
+  vector<const JitEntry*> todo;
+  for (const auto& m : Misses)
+    if (LockEntry(m.first))
+      todo.push_back(&m.second);
+  atomic<int> nFailed(0);
+  ROOT::TThreadExecutor pool(NThreads);
+  pool.Foreach([&nFailed](const JitEntry* e) { if (!CompileEntry(*e)) nFailed++; }, todo);
+
+  // Those being compiled by other jobs stay misses, until their library exists
+  for (auto it = Misses.begin(); it != Misses.end();) {
+    const TString path = EntryPath(it->first);
+    if (!gSystem->AccessPathName(path + ".so") || !gSystem->AccessPathName(path + ".failed"))
+      it = Misses.erase(it);
+    else
+      ++it;
+  }
+  summary += TString::Format(", %zu compiled now", todo.size() - nFailed);
+  if (nFailed > 0)
+    summary += TString::Format(", %d failed (see %s/*.failed)", nFailed.load(), CacheDir.Data());
+  return summary;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <TString.h>
+#include <ROOT/RDataFrame.hxx>
+
+/** On-disk cache of the string expressions of Define, Filter and of the
+ * histogram actions, compiled ahead of time into typed lambdas, one shared
+ * library per expression. Each expression is keyed by a hash of its text, of
+ * the types of the columns it reads and of the ROOT version: a hit books the
+ * compiled lambda (no Cling at all), a miss books the jitted expression as
+ * usual and is compiled by SaveJitCache for the next runs.
+ * Without OpenJitCache, the functions below are the plain jitted calls.
+ */
+
+/** Uses dir (created if needed) as the cache: its libraries are loaded when
+ * their expressions are booked.
+ */
+void OpenJitCache(TString dir);
+
+/** Like df.Define(name, expression). */
+ROOT::RDF::RNode CachedDefine(ROOT::RDF::RNode df, TString name, TString expression);
+
+/** Like df.Filter(expression, filterName). */
+ROOT::RDF::RNode CachedFilter(ROOT::RDF::RNode df, TString expression, TString filterName = "");
+
+/** Like df.Histo1D(model, column). */
+ROOT::RDF::RResultPtr<TH1D> CachedHisto1D(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel& model,
+                                          TString column);
+
+/** Like df.Histo2D(model, columnX, columnY). */
+ROOT::RDF::RResultPtr<TH2D> CachedHisto2D(ROOT::RDF::RNode df, const ROOT::RDF::TH2DModel& model,
+                                          TString columnX, TString columnY);
+
+/** Compiles each expression that missed the cache into its own library of
+ * the cache directory, unless another job sharing the directory compiles it
+ * or it failed to compile before (then it stays jitted). Returns a summary of
+ * the hits and misses, empty if no cache is open.
+ */
+TString SaveJitCache();
@@ -0,0 +1,117 @@
+#include "MemoryBudget.hh" // Own include
+#include "SigBkgPlotter.hh"
+#include <TSystem.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+/** Bytes of a histogram besides its bins (object, axes, title, ...). */
+static const ULong64_t HistoOverhead = 2048;
+
+static double ToMB(ULong64_t bytes) { return bytes / 1048576.0; }
+
+ULong64_t Footprint::Total(unsigned int nSlots, size_t purityReserve) const
+{
+  ULong64_t res = perSlot * nSlots + fixed;
+  if (eventLists == 0) return res;
+  // Reserved for purityReserve entries, then the capacity doubles as needed
+  ULong64_t capacity = max<ULong64_t>(purityReserve, 1);
+  while (capacity * eventLists < eventListEntries)
+    capacity *= 2;
+  return res + eventLists * capacity * sizeof(SigBkgPlotter::filterElement);
+}
+
+Footprint& Footprint::operator+=(const Footprint& other)
+{
+  perSlot += other.perSlot;
+  fixed += other.fixed;
+  eventLists += other.eventLists;
+  eventListEntries += other.eventListEntries;
+  return *this;
+}
+
+ULong64_t HistoBytes(Long64_t xBins, Long64_t yBins)
+{
+  // Bins of TH1D/TH2D, with under/overflows, no Sumw2 (unweighted fills)
+  const Long64_t nCells = (xBins + 2) * (yBins > 0 ? yBins + 2 : 1);
+  return nCells * sizeof(double) + HistoOverhead;
+}
+
+MemoryPlan PlanMemory(const Footprint& fp, ULong64_t budget, unsigned int nSlots, size_t purityReserve)
+{
+  MemoryPlan plan {nSlots, purityReserve};
+  const ULong64_t expected = fp.eventLists > 0 ? fp.eventListEntries / fp.eventLists : 0;
+  if (fp.Total(plan.nSlots, plan.purityReserve) > budget && plan.purityReserve > expected) {
+    plan.purityReserve = expected; // The reservation only saves the reallocations
+    cout << "Memory budget: the purity event lists are reserved for " << expected << " entries instead of "
+         << purityReserve << endl;
+  }
+  while (fp.Total(plan.nSlots, plan.purityReserve) > budget && plan.nSlots > 1)
+    plan.nSlots--;
+  if (plan.nSlots != nSlots)
+    cout << "Memory budget: " << plan.nSlots << " slots instead of " << nSlots << endl;
+  if (fp.Total(plan.nSlots, plan.purityReserve) > budget)
+    cout << TString::Format("Memory budget: the estimate (%.0f MB) is still over the budget (%.0f MB)",
+                            ToMB(fp.Total(plan.nSlots, plan.purityReserve)), ToMB(budget)) << endl;
+  return plan;
+}
+
+void PrintFootprints(const vector<pair<TString,Footprint>>& fps, unsigned int nSlots, size_t purityReserve)
+{
+  TString fs;
+  Footprint total;
+  cout << "Estimated memory (" << nSlots << " slots)" << endl;
+  cout << "   Part                        |  Per slot  |   Fixed    |Event lists |   Total" << endl;
+  cout << "   ----------------------------+------------+------------+------------+------------" << endl;
+  for (const auto& nfp : fps) {
+    const Footprint& fp = nfp.second;
+    fs.Form("   %-28s|%8.1f MB |%8.1f MB |%8.1f MB |%8.1f MB", nfp.first.Data(), ToMB(fp.perSlot),
+            ToMB(fp.fixed), ToMB(fp.Total(0, purityReserve) - fp.fixed), ToMB(fp.Total(nSlots, purityReserve)));
+    cout << fs << endl;
+    total += fp;
+  }
+  fs.Form("   %-28s|%8.1f MB |%8.1f MB |%8.1f MB |%8.1f MB", "All", ToMB(total.perSlot),
+          ToMB(total.fixed), ToMB(total.Total(0, purityReserve) - total.fixed),
+          ToMB(total.Total(nSlots, purityReserve)));
+  cout << fs << endl;
+}
+
+ULong64_t PeakRSS()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss * 1024ull; // kB on Linux
+}
+
+RSSMonitor::RSSMonitor(ULong64_t budget)
+: m_budget(budget)
+{
+  m_thread = thread([this]() {
+    bool warned = false;
+    unique_lock<mutex> lock(m_mutex);
+    while (!m_stop) {
+      ProcInfo_t info;
+      gSystem->GetProcInfo(&info);
+      const ULong64_t rss = info.fMemResident * 1024ull; // kB
+      if (m_budget > 0 && rss > m_budget && !warned) {
+        cout << TString::Format("WARNING: resident memory %.0f MB, over the budget of %.0f MB",
+                                ToMB(rss), ToMB(m_budget)) << endl;
+        warned = true;
+      }
+      m_stopped.wait_for(lock, chrono::seconds(1));
+    }
+  });
+}
+
+RSSMonitor::~RSSMonitor()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_stopped.notify_one();
+  m_thread.join();
+  cout << TString::Format("Peak resident memory: %.0f MB", ToMB(PeakRSS())) << endl;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <TString.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/** Estimated memory of the actions booked by a plotter (or another part of
+ * the analysis), before the event loop.
+ */
+typedef struct Footprint {
+  ULong64_t perSlot = 0;    /**< Bytes of the partial results of each slot (e.g. the histograms). */
+  ULong64_t fixed = 0;      /**< Bytes allocated once. */
+  ULong64_t eventLists = 0; /**< Number of PurityH1D event lists. */
+  ULong64_t eventListEntries = 0; /**< Expected entries of all the event lists together. */
+
+  /** Estimated bytes with nSlots slots. */
+  ULong64_t Total(unsigned int nSlots, size_t purityReserve) const;
+
+  Footprint& operator+=(const Footprint& other);
+} Footprint;
+
+/** Estimated bytes of a histogram with xBins (and yBins if 2D). */
+ULong64_t HistoBytes(Long64_t xBins, Long64_t yBins = 0);
+
+/** A cheaper configuration of the analysis. */
+typedef struct MemoryPlan {
+  unsigned int nSlots;  /**< Slots (threads) of the event loops. */
+  size_t purityReserve; /**< Initial size of the PurityH1D event lists. */
+} MemoryPlan;
+
+/** Returns the most parallel configuration whose estimated footprint fits in
+ * budget bytes: the event lists are only reserved for their expected entries,
+ * then the slots are reduced, down to one. Prints what was changed.
+ */
+MemoryPlan PlanMemory(const Footprint& fp, ULong64_t budget, unsigned int nSlots, size_t purityReserve);
+
+/** Prints a table with the footprint of each part (name, footprint) and the
+ * total.
+ */
+void PrintFootprints(const std::vector<std::pair<TString,Footprint>>& fps, unsigned int nSlots,
+                     size_t purityReserve);
+
+/** Peak resident memory of the process up to now, in bytes. */
+ULong64_t PeakRSS();
+
+/** Samples the resident memory every second while it exists, and warns
+ * (once) as soon as it goes over the budget, so that a job killed for its
+ * memory leaves a trace.
+ */
+class RSSMonitor {
+ public:
+  RSSMonitor() = delete;
+  RSSMonitor(const RSSMonitor&) = delete;
+  RSSMonitor(RSSMonitor&&) = delete;
+  RSSMonitor& operator=(const RSSMonitor&) = delete;
+  RSSMonitor& operator=(RSSMonitor&&) = delete;
+
+  /** @param budget In bytes, 0 for no warning */
+  explicit RSSMonitor(ULong64_t budget);
+
+  /** Stops sampling and prints the peak resident memory. */
+  ~RSSMonitor();
+
+ private:
+  ULong64_t m_budget;
+  bool m_stop = false;
+  std::mutex m_mutex; /**< For m_stop. */
+  std::condition_variable m_stopped;
+  std::thread m_thread;
+};
@@ -0,0 +1,108 @@
+#include "NpyExport.hh" // Own include
+#include "Utils.hh"
+#include <TSystem.h>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+/** Bytes of the .npy headers, enough for any shape (a multiple of 64, for
+ * the alignment of the data).
+ */
+static const size_t NpyHeaderSize = 128;
+
+/** Appends the bytes of x to v. */
+template <class T>
+static void Append(vector<char>& v, T x)
+{
+  char bytes[sizeof(T)];
+  memcpy(bytes, &x, sizeof(T));
+  v.insert(v.end(), bytes, bytes + sizeof(T));
+}
+
+NpyExporter::NpyExporter(TString dir, const vector<TString>& features, int nSlots)
+: m_dir(dir), m_features(features)
+{
+  gSystem->mkdir(m_dir, true);
+  for (const char* id : {"__experiment__", "__run__", "__event__", "__candidate__"})
+    m_columns.push_back({id, "<i4", sizeof(Int_t), nullptr});
+  m_columns.push_back({"isSignal", "|u1", sizeof(uint8_t), nullptr});
+  for (const auto& f : m_features)
+    m_columns.push_back({f, "<f8", sizeof(double), nullptr});
+
+  for (auto& c : m_columns) {
+    const TString fileName = m_dir + "/" + c.name + ".npy";
+    c.file = fopen(fileName, "wb");
+    CHECKA(c.file && WriteHeader(c, 0), "cannot create " + fileName);
+  }
+  m_slots.resize(nSlots);
+  for (auto& b : m_slots) {
+    b.data.resize(m_columns.size());
+    for (size_t i = 0; i < m_columns.size(); i++)
+      b.data[i].reserve(ExportBatchSize * m_columns[i].size);
+  }
+}
+
+NpyExporter::~NpyExporter()
+{
+  for (auto& c : m_columns)
+    if (c.file)
+      fclose(c.file);
+}
+
+bool NpyExporter::WriteHeader(const Column& c, ULong64_t rows)
+{
+  // Format 1.0: magic, version, header length, then a Python dict padded
+  // with spaces and ended by a newline
+  TString dict = TString::Format("{'descr': '%s', 'fortran_order': False, 'shape': (%llu,), }",
+                                 c.descr.Data(), rows);
+  const size_t dictSize = NpyHeaderSize - 10;
+  while ((size_t)dict.Length() < dictSize - 1)
+    dict += " ";
+  dict += "\n";
+  const char preamble[10] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                             (char)(dictSize & 0xff), (char)(dictSize >> 8)};
+  return fseek(c.file, 0, SEEK_SET) == 0 && fwrite(preamble, 1, 10, c.file) == 10 &&
+         fwrite(dict.Data(), 1, dictSize, c.file) == dictSize && fseek(c.file, 0, SEEK_END) == 0;
+}
+
+void NpyExporter::Accumulate(UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand, bool sig,
+                             const ROOT::RVec<double>& features)
+{
+  SlotBuffers& b = m_slots[iSlot];
+  Append(b.data[0], exp);
+  Append(b.data[1], run);
+  Append(b.data[2], evt);
+  Append(b.data[3], cand);
+  Append(b.data[4], (uint8_t)sig);
+  for (size_t i = 0; i < m_features.size(); i++)
+    Append(b.data[5 + i], features[i]);
+  if (++b.rows == ExportBatchSize)
+    Flush(b);
+}
+
+void NpyExporter::Flush(SlotBuffers& b)
+{
+  if (b.rows == 0) return;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_columns.size(); i++)
+      m_failed |= fwrite(b.data[i].data(), 1, b.data[i].size(), m_columns[i].file) != b.data[i].size();
+    m_rows += b.rows;
+  }
+  for (auto& d : b.data)
+    d.clear();
+  b.rows = 0;
+}
+
+ULong64_t NpyExporter::Close()
+{
+  for (auto& b : m_slots)
+    Flush(b);
+  for (auto& c : m_columns) {
+    m_failed |= !WriteHeader(c, m_rows);
+    m_failed |= fclose(c.file) != 0;
+    c.file = nullptr;
+  }
+  CHECKA(!m_failed, m_dir + ": some columns could not be written");
+  return m_rows;
+}
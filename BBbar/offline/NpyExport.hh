@@ -0,0 +1,97 @@
+#pragma once
+#include "Constants.hh"
+#include "JitCache.hh"
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+/** Writes candidates to a directory of NumPy .npy files, one per column
+ * (exp/run/event/candidate, the isSignal label, then the features), that
+ * numpy.load(..., mmap_mode="r") maps without copies. Each slot fills column
+ * buffers of ExportBatchSize rows, appended to the files in one go: the rows
+ * of the different slots are interleaved by batches, in the same order in
+ * all the files.
+ */
+class NpyExporter {
+ public:
+  NpyExporter() = delete;
+  NpyExporter(const NpyExporter&) = delete;
+  NpyExporter(NpyExporter&&) = delete;
+  NpyExporter& operator=(const NpyExporter&) = delete;
+  NpyExporter& operator=(NpyExporter&&) = delete;
+
+  /** Creates dir and the files.
+   * @param features Expressions of the float64 columns, also their names
+   */
+  NpyExporter(TString dir, const std::vector<TString>& features, int nSlots = NThreads);
+
+  /** Closes the files if Close was not called (their headers are then wrong). */
+  ~NpyExporter();
+
+  /** Called in the event loop (see BookExport) with the slot and columns =
+   * {"__experiment__", "__run__", "__event__", "__candidate__", "isSignal",
+   * "features"}, with one value per feature.
+   */
+  void Accumulate(UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand, bool sig,
+                  const ROOT::RVec<double>& features);
+
+  /** Writes the rest of the buffers and the final shapes (after the loop),
+   * then returns the number of rows. Throws if a write failed.
+   */
+  ULong64_t Close();
+
+  const std::vector<TString>& GetFeatures() const { return m_features; }
+
+ private:
+  typedef struct Column {
+    TString name;
+    TString descr; /**< NumPy dtype, e.g. "<f8". */
+    size_t size;   /**< Bytes per value. */
+    FILE* file;
+  } Column;
+
+  typedef struct alignas(64) SlotBuffers { // Written by one thread
+    std::vector<std::vector<char>> data; /**< One per column. */
+    size_t rows = 0;
+  } SlotBuffers;
+
+  /** Appends the buffers of a slot to the files and empties them. */
+  void Flush(SlotBuffers& b);
+
+  /** Writes the header of c for the given number of rows at the beginning of
+   * the file (always the same size).
+   */
+  bool WriteHeader(const Column& c, ULong64_t rows);
+
+  TString m_dir;
+  std::vector<TString> m_features;
+  std::vector<Column> m_columns;
+  std::vector<SlotBuffers> m_slots;
+  ULong64_t m_rows = 0;
+  bool m_failed = false;
+  std::mutex m_mutex; /**< For the files, m_rows and m_failed. */
+};
+
+/** Books the export of the candidates of df: exporter is filled by the next
+ * event loop (lazy), whose entries are counted by the returned result (e.g.
+ * for RunGraphs).
+ */
+template <class T>
+ROOT::RDF::RResultPtr<ULong64_t> BookExport(ROOT::RDF::RInterface<T,void>& df, NpyExporter& exporter)
+{
+  TString valuesExpr = "ROOT::RVec<double>{";
+  for (const auto& f : exporter.GetFeatures())
+    valuesExpr += (valuesExpr.EndsWith("{") ? "double(" : ", double(") + f + ")";
+  valuesExpr += "}";
+  TString sigExpr = TString::Format("(%s) ? 1.0 : 0.0", SignalCondition.Data());
+
+  return CachedDefine(CachedDefine(df, "exporttmpSig", sigExpr), "exporttmpValues", valuesExpr).Filter(
+    [&exporter](UInt_t iSlot, Int_t exp, Int_t run, Int_t evt, Int_t cand,
+                double sig, const ROOT::RVec<double>& values) {
+      exporter.Accumulate(iSlot, exp, run, evt, cand, sig == 1.0, values);
+      return true;
+    }, {"rdfslot_", "__experiment__", "__run__", "__event__", "__candidate__", "exporttmpSig", "exporttmpValues"})
+    .Count();
+}
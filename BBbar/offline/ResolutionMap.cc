@@ -0,0 +1,146 @@
+#include "ResolutionMap.hh" // Own include
+#include "Utils.hh"
+#include <TMath.h>
+#include <algorithm>
+using namespace std;
+
+ResolutionMapAccumulator::ResolutionMapAccumulator(const vector<ResolutionMapAxis>& axes, TString name, int nSlots)
+: m_axes(axes), m_name(name)
+{
+  CHECKA(m_axes.size() >= 2, name);
+  double nBins = 1;
+  for (const auto& a : m_axes) {
+    CHECKA(a.nBins > 0 && a.up > a.low, name + ": " + a.name);
+    nBins *= a.nBins + 2;
+  }
+  CHECKA(nBins < 1e18, TString::Format("%s: %g bins", name.Data(), nBins)); // Global bins fit in a Long64_t
+  m_slots.resize(nSlots);
+}
+
+void ResolutionMapAccumulator::Accumulate(UInt_t iSlot, const ROOT::RVec<double>& values)
+{
+  Long64_t bin = 0;
+  for (size_t i = 0; i < m_axes.size(); i++) {
+    const auto& a = m_axes[i];
+    const double x = values[i];
+    if (TMath::IsNaN(x)) return;
+    int j;
+    if (x < a.low) j = 0;
+    else if (x >= a.up) j = a.nBins + 1;
+    else j = TMath::Min(1 + (int)((x - a.low) / (a.up - a.low) * a.nBins), a.nBins);
+    bin = bin * (a.nBins + 2) + j;
+  }
+  m_slots[iSlot][bin]++;
+}
+
+THnSparseD* ResolutionMapAccumulator::GetResult() const
+{
+  const int dim = m_axes.size();
+  vector<int> nBins;
+  vector<double> xMin, xMax;
+  for (const auto& a : m_axes) {
+    nBins.push_back(a.nBins);
+    xMin.push_back(a.low);
+    xMax.push_back(a.up);
+  }
+  auto h = new THnSparseD(GetUniqueName(m_name), m_name, dim, nBins.data(), xMin.data(), xMax.data());
+  for (int i = 0; i < dim; i++)
+    h->GetAxis(i)->SetTitle(m_axes[i].name);
+
+  // Merge slots
+  vector<int> idx(dim);
+  double entries = 0;
+  for (const auto& slot : m_slots) {
+    for (const auto& [bin, w] : slot) {
+      Long64_t rest = bin;
+      for (int i = dim - 1; i >= 0; i--) {
+        idx[i] = rest % (nBins[i] + 2);
+        rest /= nBins[i] + 2;
+      }
+      h->AddBinContent(idx.data(), w);
+      entries += w;
+    }
+  }
+  h->SetEntries(entries);
+  return h;
+}
+
+THnSparseD* ProjectResolutionMap(const THnSparseD* map, const vector<int>& axes)
+{
+  vector<int> dims = axes;
+  dims.push_back(map->GetNdimensions() - 1);
+  return (THnSparseD*)map->Projection(dims.size(), dims.data());
+}
+
+THnSparseD* SigmaMap(const THnSparseD* map, TString name, double N)
+{
+  const int dim = map->GetNdimensions();
+  CHECKA(dim >= 2, TString(map->GetName()));
+  const TAxis* resAxis = map->GetAxis(dim - 1);
+  const int nRes = resAxis->GetNbins();
+
+  // Filled bins, sorted by cell of the other axes
+  typedef struct Filled {
+    Long64_t cell;
+    int res; /**< Bin of the residual. */
+    double w;
+  } Filled;
+  vector<Filled> filled;
+  filled.reserve(map->GetNbins());
+  vector<int> idx(dim);
+  for (Long64_t i = 0; i < map->GetNbins(); i++) {
+    const double w = map->GetBinContent(i, idx.data());
+    if (w == 0) continue;
+    Long64_t cell = 0;
+    for (int j = 0; j < dim - 1; j++)
+      cell = cell * (map->GetAxis(j)->GetNbins() + 2) + idx[j];
+    filled.push_back({cell, idx[dim - 1], w});
+  }
+  sort(filled.begin(), filled.end(), [](const Filled& a, const Filled& b) { return a.cell < b.cell; });
+
+  vector<int> nBins;
+  vector<double> xMin, xMax;
+  for (int j = 0; j < dim - 1; j++) {
+    nBins.push_back(map->GetAxis(j)->GetNbins());
+    xMin.push_back(map->GetAxis(j)->GetXmin());
+    xMax.push_back(map->GetAxis(j)->GetXmax());
+  }
+  auto res = new THnSparseD(name, TString::Format("#sigma_{%.0f} of %s", N, map->GetTitle()),
+                            dim - 1, nBins.data(), xMin.data(), xMax.data());
+  for (int j = 0; j < dim - 1; j++)
+    res->GetAxis(j)->SetTitle(map->GetAxis(j)->GetTitle());
+  res->Sumw2();
+
+  const double remainder = (100.0 - N) / 200.0;
+  vector<double> counts(nRes + 2);
+  for (size_t first = 0, last; first < filled.size(); first = last) {
+    double samples = 0.0;
+    fill(counts.begin(), counts.end(), 0.0);
+    for (last = first; last < filled.size() && filled[last].cell == filled[first].cell; last++) {
+      counts[filled[last].res] += filled[last].w;
+      samples += filled[last].w;
+    }
+    if (samples < ResolutionMapMinEntries) continue;
+
+    // Find sigmaN interval, as SigBkgPlotter::SigmaAndWrite
+    int binLow, binUp;
+    double accuLow, accuUp;
+    for (accuLow = 0.0, binLow = 0; binLow < nRes + 1; binLow++)
+      if ((accuLow += counts[binLow]) / samples >= remainder)
+        break;
+    for (accuUp = 0.0, binUp = nRes + 1; binUp > binLow; binUp--)
+      if ((accuUp += counts[binUp]) / samples >= remainder)
+        break;
+    // Interval -> from up edge of binLow to low edge of binUp
+    const double xWidth = (resAxis->GetBinLowEdge(binUp) - resAxis->GetBinLowEdge(binLow + 1)) / 2.0;
+
+    Long64_t rest = filled[first].cell;
+    for (int j = dim - 2; j >= 0; j--) {
+      idx[j] = rest % (nBins[j] + 2);
+      rest /= nBins[j] + 2;
+    }
+    res->SetBinContent(idx.data(), xWidth);
+    res->SetBinError(idx.data(), resAxis->GetBinWidth(1));
+  }
+  return res;
+}
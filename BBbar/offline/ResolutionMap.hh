@@ -0,0 +1,75 @@
+#pragma once
+#include "Constants.hh"
+#include "JitCache.hh"
+#include <THnSparse.h>
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <unordered_map>
+#include <vector>
+
+/** Fills an N-dimensional histogram of a residual and of the variables it
+ * is binned in, in a single event loop, with a hash map of the filled bins
+ * per slot: the memory grows with the filled bins only, instead of the
+ * product of the numbers of bins of the axes.
+ */
+class ResolutionMapAccumulator {
+ public:
+  ResolutionMapAccumulator() = delete;
+  ResolutionMapAccumulator(const ResolutionMapAccumulator&) = delete;
+  ResolutionMapAccumulator(ResolutionMapAccumulator&&) = delete;
+  ResolutionMapAccumulator& operator=(const ResolutionMapAccumulator&) = delete;
+  ResolutionMapAccumulator& operator=(ResolutionMapAccumulator&&) = delete;
+
+  /** @param axes The axes, without $p, the residual being the last one
+   * @param nSlots The number of slots of the event loop (df.GetNSlots())
+   */
+  ResolutionMapAccumulator(const std::vector<ResolutionMapAxis>& axes, TString name, int nSlots);
+
+  /** Called in the event loop (see BookResolutionMap) with the slot and
+   * columns = {"values"}, with one value per axis.
+   */
+  void Accumulate(UInt_t iSlot, const ROOT::RVec<double>& values);
+
+  /** Returns the merged map, with the underflow and overflow bins of each
+   * axis (after the loop).
+   */
+  THnSparseD* GetResult() const;
+
+  const std::vector<ResolutionMapAxis>& GetAxes() const { return m_axes; }
+
+ private:
+  std::vector<ResolutionMapAxis> m_axes;
+  TString m_name;
+  std::vector<std::unordered_map<Long64_t,double>> m_slots; /**< Entries by global bin. */
+};
+
+/** Books the filling of accu on the candidates of df: accu is filled by the
+ * next event loop (lazy), whose entries are counted by the returned result
+ * (e.g. for RunGraphs).
+ */
+template <class T>
+ROOT::RDF::RResultPtr<ULong64_t> BookResolutionMap(ROOT::RDF::RInterface<T,void>& df, ResolutionMapAccumulator& accu)
+{
+  TString valuesExpr = "ROOT::RVec<double>{";
+  for (const auto& a : accu.GetAxes())
+    valuesExpr += (valuesExpr.EndsWith("{") ? "double(" : ", double(") + a.expression + ")";
+  valuesExpr += "}";
+
+  return CachedDefine(df, "resmaptmpValues", valuesExpr)
+    .Filter([&accu](UInt_t iSlot, const ROOT::RVec<double>& values) {
+      accu.Accumulate(iSlot, values);
+      return true;
+    }, {"rdfslot_", "resmaptmpValues"}).Count();
+}
+
+/** Projects map on the given axes, keeping the residual axis (last): e.g.
+ * {0} for the residual vs p only. The caller owns the result.
+ */
+THnSparseD* ProjectResolutionMap(const THnSparseD* map, const std::vector<int>& axes);
+
+/** Returns the sigmaN of the residual (the half-width that contains N% of the
+ * entries, with half of the remainder on each side) in each cell of the
+ * other axes of map with ResolutionMapMinEntries entries at least, and the
+ * bin width as error. The caller owns the result.
+ */
+THnSparseD* SigmaMap(const THnSparseD* map, TString name, double N = 68.0);
@@ -0,0 +1,91 @@
+#include "ResultWriter.hh" // Own include
+#include "Utils.hh"
+#include <TFile.h>
+#include <TH1.h>
+#include <TROOT.h>
+using namespace std;
+
+/** Objects queued at most, beyond which Write waits for the thread. */
+static const size_t MaxQueued = 1024;
+
+ResultWriter* ResultWriter::s_current = nullptr;
+
+ResultWriter::ResultWriter(TFile& file)
+: m_file(file)
+{
+  CHECKA(!s_current, TString("only one ResultWriter at a time"));
+  ROOT::EnableThreadSafety();
+  m_thread = thread(&ResultWriter::Loop, this);
+  s_current = this;
+}
+
+ResultWriter::~ResultWriter()
+{
+  if (m_thread.joinable()) {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+  }
+  s_current = nullptr;
+}
+
+void ResultWriter::Write(const TObject* obj, TString name)
+{
+  CHECK(obj);
+  TObject* copy;
+  {
+    TDirectory::TContext noDir(nullptr); // Not attached to the file (written by the thread)
+    copy = obj->Clone();
+  }
+  if (copy->InheritsFrom(TH1::Class()))
+    ((TH1*)copy)->SetDirectory(nullptr);
+
+  unique_lock<mutex> lock(m_mutex);
+  CHECKA(!m_stop, TString("ResultWriter closed"));
+  m_changed.wait(lock, [this] { return m_queue.size() < MaxQueued; });
+  m_queue.push_back({m_dir, name, unique_ptr<TObject>(copy)});
+  m_changed.notify_all();
+}
+
+void ResultWriter::Loop()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (true) {
+    m_changed.wait(lock, [this] { return !m_queue.empty() || m_stop; });
+    if (m_queue.empty()) return; // Stopped
+    Item item = move(m_queue.front());
+    m_queue.pop_front();
+    m_changed.notify_all(); // Room in the queue
+    lock.unlock();
+
+    TDirectory* dir = item.dir.IsNull() ? &m_file : m_file.mkdir(item.dir, item.dir, true);
+    const bool ok = dir && dir->WriteTObject(item.obj.get(), item.name.IsNull() ? nullptr : item.name.Data()) > 0;
+    item.obj.reset();
+
+    lock.lock();
+    m_failed |= !ok;
+  }
+}
+
+void ResultWriter::Close()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_changed.notify_all();
+  m_thread.join();
+  s_current = nullptr;
+  CHECKA(!m_failed, m_file.GetName() + TString(": some results could not be written"));
+}
+
+void WriteResult(const TObject* obj, TString name)
+{
+  if (ResultWriter* writer = ResultWriter::GetCurrent())
+    writer->Write(obj, name);
+  else
+    gDirectory->WriteTObject(obj, name.IsNull() ? nullptr : name.Data());
+}
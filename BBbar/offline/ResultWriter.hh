@@ -0,0 +1,73 @@
+#pragma once
+#include <TString.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+// Forward declarations
+class TObject;
+class TFile;
+
+/** Writes the results to a file from a background thread, so that their
+ * serialization and compression overlap with the drawing. The objects are
+ * copied when they are handed over (see WriteResult), the callers can change
+ * or delete theirs right away. While it exists, the other threads must not
+ * use the file, nor leave gDirectory in it.
+ */
+class ResultWriter {
+ public:
+  ResultWriter() = delete;
+  ResultWriter(const ResultWriter&) = delete;
+  ResultWriter(ResultWriter&&) = delete;
+  ResultWriter& operator=(const ResultWriter&) = delete;
+  ResultWriter& operator=(ResultWriter&&) = delete;
+
+  /** Starts the thread, and becomes the target of WriteResult. */
+  explicit ResultWriter(TFile& file);
+
+  /** Same as Close, without the check. */
+  ~ResultWriter();
+
+  /** Directory of the following objects (created if needed), "" for the top
+   * directory of the file.
+   */
+  void cd(TString dir) { m_dir = dir; }
+
+  /** Queues a copy of obj, named name (obj's name if empty). Waits if too
+   * many objects are queued already.
+   */
+  void Write(const TObject* obj, TString name = "");
+
+  /** Writes the queued objects and stops the thread. Throws if a write
+   * failed.
+   */
+  void Close();
+
+  /** The writer of WriteResult, nullptr if none. */
+  static ResultWriter* GetCurrent() { return s_current; }
+
+ private:
+  typedef struct Item {
+    TString dir;
+    TString name;
+    std::unique_ptr<TObject> obj;
+  } Item;
+
+  void Loop();
+
+  TFile& m_file;
+  TString m_dir;
+  std::deque<Item> m_queue;
+  bool m_stop = false;
+  bool m_failed = false;
+  std::mutex m_mutex; /**< For m_queue, m_stop and m_failed. */
+  std::condition_variable m_changed;
+  std::thread m_thread;
+  static ResultWriter* s_current;
+};
+
+/** Writes obj (named name, or its own name) with the current ResultWriter,
+ * or to gDirectory if there is none.
+ */
+void WriteResult(const TObject* obj, TString name = "");
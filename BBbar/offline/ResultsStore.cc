@@ -0,0 +1,146 @@
+#include "ResultsStore.hh" // Own include
+#include "Utils.hh"
+#include <TSystem.h>
+#include <TFile.h>
+#include <TMD5.h>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <ctime>
+using namespace std;
+
+const TString IndexFileName = "index.txt";
+const TString KeyFileName = "key.txt";
+
+ResultsStore::ResultsStore(TString dir, TString key) : m_dir(dir)
+{
+  if (gSystem->AccessPathName(m_dir)) // Returns true if it does NOT exist
+    CHECKA(gSystem->mkdir(m_dir, true) == 0, "cannot create " + m_dir);
+  const TString oldKey = ReadKey();
+  if (oldKey == key) {
+    ReadIndex();
+    return;
+  }
+  if (!gSystem->AccessPathName(m_dir + "/" + IndexFileName))
+    cout << "The results in " << m_dir << " were made with other options (\"" << oldKey << "\", now \""
+         << key << "\"), all the files will be processed again." << endl;
+  WriteIndex(); // Empty, before the new key (an interrupted run must not mix them)
+  {
+    ofstream ofs((m_dir + "/" + KeyFileName).Data());
+    ofs << key << endl;
+    CHECKA(ofs.good(), m_dir + "/" + KeyFileName);
+  }
+}
+
+vector<TString> ResultsStore::GetNewFiles(const vector<TString>& files)
+{
+  vector<TString> res;
+  for (const TString& file : files) {
+    auto it = m_index.find(file);
+    if (it == m_index.end() || MakeEntry(file).md5 != it->second.md5)
+      res.push_back(file);
+  }
+  return res;
+}
+
+void ResultsStore::Save(TString file, function<void(TDirectory*)> writer)
+{
+  Entry entry = MakeEntry(file);
+  TMD5 pathHash;
+  pathHash.Update((const UChar_t*)file.Data(), file.Length());
+  pathHash.Final();
+  entry.partial = pathHash.AsString() + ".root"TS;
+
+  {
+    TFile partial(m_dir + "/" + entry.partial, "recreate");
+    CHECKA(!partial.IsZombie(), m_dir + "/" + entry.partial);
+    writer(&partial);
+  }
+  m_index[file] = entry;
+  WriteIndex(); // Immediately, so that an interrupted run loses nothing
+}
+
+void ResultsStore::ForEachPartial(const vector<TString>& files,
+                                  function<void(TDirectory*)> reader, TString exclude)
+{
+  for (const TString& file : files) {
+    if (file == exclude) continue;
+    auto it = m_index.find(file);
+    if (it == m_index.end()) continue;
+    TFile partial(m_dir + "/" + it->second.partial, "read");
+    CHECKA(!partial.IsZombie(), m_dir + "/" + it->second.partial);
+    reader(&partial);
+  }
+}
+
+vector<TString> ResultsStore::ListRootFiles(TString dir, long minAge)
+{
+  vector<TString> res;
+  void* dirp = gSystem->OpenDirectory(dir);
+  CHECKA(dirp, "cannot open " + dir);
+  const long now = time(nullptr);
+  while (const char* entry = gSystem->GetDirEntry(dirp)) {
+    TString name = entry;
+    if (!name.EndsWith(".root")) continue;
+    TString path = dir + "/" + name;
+    FileStat_t st;
+    if (gSystem->GetPathInfo(path, st) != 0 || !R_ISREG(st.fMode)) continue;
+    if (now - st.fMtime < minAge) continue;
+    res.push_back(path);
+  }
+  gSystem->FreeDirectory(dirp);
+  sort(res.begin(), res.end());
+  return res;
+}
+
+void ResultsStore::ReadIndex()
+{
+  ifstream ifs((m_dir + "/" + IndexFileName).Data());
+  Entry entry;
+  string md5, partial, path;
+  while (ifs >> md5 >> entry.size >> entry.mtime >> partial && getline(ifs >> ws, path)) {
+    entry.md5 = md5;
+    entry.partial = partial;
+    m_index[path] = entry;
+  }
+}
+
+TString ResultsStore::ReadKey() const
+{
+  ifstream ifs((m_dir + "/" + KeyFileName).Data());
+  string key;
+  getline(ifs, key);
+  return key.c_str();
+}
+
+void ResultsStore::WriteIndex() const
+{
+  TString indexPath = m_dir + "/" + IndexFileName;
+  {
+    ofstream ofs((indexPath + ".tmp").Data());
+    for (const auto& t : m_index) {
+      const Entry& e = t.second;
+      ofs << e.md5 << " " << e.size << " " << e.mtime << " " << e.partial << " " << t.first << endl;
+    }
+    CHECKA(ofs.good(), indexPath + ".tmp");
+  }
+  CHECKA(gSystem->Rename(indexPath + ".tmp", indexPath) == 0, indexPath);
+}
+
+ResultsStore::Entry ResultsStore::MakeEntry(TString file) const
+{
+  FileStat_t st;
+  CHECKA(gSystem->GetPathInfo(file, st) == 0, "cannot stat " + file);
+  Entry entry {st.fSize, st.fMtime, "", ""};
+
+  auto it = m_index.find(file);
+  if (it != m_index.end() && it->second.size == entry.size && it->second.mtime == entry.mtime) {
+    entry.md5 = it->second.md5; // Unchanged, no need to read the whole file again
+  } else {
+    TMD5* md5 = TMD5::FileChecksum(file);
+    CHECKA(md5, "cannot read " + file);
+    entry.md5 = md5->AsString();
+    delete md5;
+  }
+  return entry;
+}
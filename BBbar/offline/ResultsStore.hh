@@ -0,0 +1,74 @@
+#pragma once
+#include <TString.h>
+#include <functional>
+#include <vector>
+#include <map>
+// Forward declarations
+class TDirectory;
+
+/** A directory that keeps the partial (mergeable) results of each input
+ * file, keyed by the path and the checksum of the file. It allows to
+ * process only the files that have not been seen yet and to merge their
+ * results with those of the old ones. The results are made with given
+ * options (key), all the files are processed again if they change.
+ */
+class ResultsStore {
+ public:
+  ResultsStore() = delete;
+  ResultsStore(const ResultsStore&) = delete;
+  ResultsStore(ResultsStore&&) = delete;
+  ResultsStore& operator=(const ResultsStore&) = delete;
+  ResultsStore& operator=(ResultsStore&&) = delete;
+
+  /** Opens (or creates) the store in the given directory. If the results
+   * in it were made with another key, they are dropped (with a message).
+   */
+  ResultsStore(TString dir, TString key);
+
+  /** Returns the files which are not in the store, or whose checksum
+   * differs from the one of the stored results.
+   */
+  std::vector<TString> GetNewFiles(const std::vector<TString>& files);
+
+  /** Saves the partial results of file. writer is called with the
+   * (empty) directory in which the results shall be written.
+   */
+  void Save(TString file, std::function<void(TDirectory*)> writer);
+
+  /** Calls reader with the directory of the partial results of each of
+   * the given files found in the store, except for exclude.
+   */
+  void ForEachPartial(const std::vector<TString>& files,
+                      std::function<void(TDirectory*)> reader, TString exclude = "");
+
+  /** Lists the *.root files in a directory (not recursive), sorted by name.
+   * Files modified less than minAge seconds ago are skipped, as they may be
+   * still being written.
+   */
+  static std::vector<TString> ListRootFiles(TString dir, long minAge = 0);
+
+ private:
+  typedef struct Entry {
+    Long64_t size;   /**< Size of the file when it was processed. */
+    Long_t mtime;    /**< Modification time of the file when it was processed. */
+    TString md5;     /**< Checksum of the file when it was processed. */
+    TString partial; /**< Name of the partial results file in the store. */
+  } Entry;
+
+  /** Reads the index file. */
+  void ReadIndex();
+
+  /** Returns the key of the stored results, "" for a new store. */
+  TString ReadKey() const;
+
+  /** Writes the index file (atomically, via a temporary file). */
+  void WriteIndex() const;
+
+  /** Returns the entry file would have, computing the checksum only if
+   * size and modification time differ from the stored ones.
+   */
+  Entry MakeEntry(TString file) const;
+
+  TString m_dir; /**< Directory of the store. */
+  std::map<TString,Entry> m_index; /**< Processed files, by path. */
+};
@@ -1,6 +1,10 @@
 #include "SigBkgPlotter.hh" // Own include
 #include "Utils.hh"
 #include "Constants.hh"
+#include "FitScheduler.hh"
+#include "ResultWriter.hh"
+#include "JitCache.hh"
+#include "AutoRange.hh"
 #include <THStack.h>
 #include <TCanvas.h>
 #include <TLegend.h>
@@ -10,6 +14,7 @@
 #include <TPaveText.h>
 #include <TStyle.h>
 #include <TGraph.h>
+#include <set>
 using namespace std;
 
 SigBkgPlotter::TRRes1D SigBkgPlotter::Histo1D(
@@ -25,16 +30,23 @@ SigBkgPlotter::TRRes1D SigBkgPlotter::Histo1D(
   }
   
   TRRes1D res;
-  if (scale == 1.0) {
+  if (m_autoRange) {
+    auto range = make_shared<AutoRange>(nBins, xLow, xUp, m_sig.GetNSlots());
+    TString expr = TString::Format("double(%s)*%.18lg", variable, scale);
+    res = make_tuple(
+      BookAutoRangeHisto(CachedDefine(m_sig, "h1dtmp", expr), range, nameSig, title, "h1dtmp"),
+      sigOnly ? RRes1D() : BookAutoRangeHisto(CachedDefine(m_bkg, "h1dtmp", expr), range, nameBkg, title, "h1dtmp"));
+  } else if (scale == 1.0) {
     res = make_tuple(
-      m_sig.Histo1D({nameSig, title, nBins, xLow, xUp}, variable),
-      sigOnly ? RRes1D() : m_bkg.Histo1D({nameBkg, title, nBins, xLow, xUp}, variable));
+      CachedHisto1D(m_sig, {nameSig, title, nBins, xLow, xUp}, variable),
+      sigOnly ? RRes1D() : CachedHisto1D(m_bkg, {nameBkg, title, nBins, xLow, xUp}, variable));
   } else {
     TString expr = TString::Format("%s*%.18lg", variable, scale);
     res = make_tuple(
-      m_sig.Define("h1dtmp", expr.Data()).Histo1D({nameSig, title, nBins, xLow, xUp}, "h1dtmp"),
-      sigOnly ? RRes1D() : m_bkg.Define("h1dtmp", expr.Data()).Histo1D({nameBkg, title, nBins, xLow, xUp}, "h1dtmp"));
+      CachedHisto1D(CachedDefine(m_sig, "h1dtmp", expr), {nameSig, title, nBins, xLow, xUp}, "h1dtmp"),
+      sigOnly ? RRes1D() : CachedHisto1D(CachedDefine(m_bkg, "h1dtmp", expr), {nameBkg, title, nBins, xLow, xUp}, "h1dtmp"));
   }
+  m_registry.Add(MakeHistoKey(HistoKind::H1, variable, "", nBins, xLow, xUp), nameSig, m_h1s.size());
   m_h1s.push_back(res);
   return res;
 }
@@ -53,17 +65,18 @@ void SigBkgPlotter::Histo1D(
 SigBkgPlotter::TRRes2D SigBkgPlotter::Histo2D(
   const char* vx, const char* vy, TString title,
   int xBins, double xLow, double xUp,
-  int yBins, double yLow, double yUp)
+  int yBins, double yLow, double yUp, bool sigOnly)
 {
   TString nameSig = GetUniqueName(m_namePrefix + "_sig_" + vx + "_" + vy);
   TString nameBkg = GetUniqueName(m_namePrefix + "_bkg_" + vx + "_" + vy);
   title = m_titlePrefix + " - " + title;
   TRRes2D res = make_tuple(
-    m_sig.Histo2D(ROOT::RDF::TH2DModel(
+    CachedHisto2D(m_sig, ROOT::RDF::TH2DModel(
       nameSig, title, xBins, xLow, xUp, yBins, yLow, yUp), vx, vy),
-    m_bkg.Histo2D(ROOT::RDF::TH2DModel(
+    sigOnly ? RRes2D() : CachedHisto2D(m_bkg, ROOT::RDF::TH2DModel(
       nameBkg, title, xBins, xLow, xUp, yBins, yLow, yUp), vx, vy)
   );
+  m_registry.Add(MakeHistoKey(HistoKind::H2, vx, vy, xBins, xLow, xUp, yBins, yLow, yUp), nameSig, m_h2s.size());
   m_h2s.push_back(res);
   return res;
 }
@@ -72,13 +85,13 @@ void SigBkgPlotter::Histo2D(
   std::initializer_list<TString> particles,
   const char *vx, const char *vy, TString title,
   int xBins, double xLow, double xUp,
-  int yBins, double yLow, double yUp)
+  int yBins, double yLow, double yUp, bool sigOnly)
 {
   for (const TString& p : particles) {
     TString t = title; // Replacement happens in-place :(
     TString pvx = p + "_" + vx, pvy = p + "_" + vy;
     Histo2D(pvx, pvy, t.ReplaceAll("$p", ParticlesTitles.at(p)),
-            xBins, xLow, xUp, yBins, yLow, yUp);
+            xBins, xLow, xUp, yBins, yLow, yUp, sigOnly);
   }
 }
 
@@ -97,14 +110,15 @@ SigBkgPlotter::TRRes1D SigBkgPlotter::EffH1D(
   TRRes1D res;
   if (scale == 1.0) {
     res = make_tuple(
-      m_sig.Histo1D({nameSig, titleSig, nBins, xLow, xUp}, variable),
-      m_mc.Histo1D({nameMC, titleMC, nBins, xLow, xUp}, variable));
+      CachedHisto1D(m_sig, {nameSig, titleSig, nBins, xLow, xUp}, variable),
+      CachedHisto1D(m_mc, {nameMC, titleMC, nBins, xLow, xUp}, variable));
   } else {
     TString expr = TString::Format("%s*%.18lg", variable, scale);
     res = make_tuple(
-      m_sig.Define("h1dtmp", expr.Data()).Histo1D({nameSig, titleSig, nBins, xLow, xUp}, "h1dtmp"),
-      m_mc.Define("h1dtmp", expr.Data()).Histo1D({nameMC, titleMC, nBins, xLow, xUp}, "h1dtmp"));
+      CachedHisto1D(CachedDefine(m_sig, "h1dtmp", expr), {nameSig, titleSig, nBins, xLow, xUp}, "h1dtmp"),
+      CachedHisto1D(CachedDefine(m_mc, "h1dtmp", expr), {nameMC, titleMC, nBins, xLow, xUp}, "h1dtmp"));
   }
+  m_registry.Add(MakeHistoKey(HistoKind::Eff, variable, "", nBins, xLow, xUp), nameSig, m_effh1s.size());
   m_effh1s.push_back(res);
   return res;
 }
@@ -142,7 +156,7 @@ SigBkgPlotter::TRRes1D SigBkgPlotter::PurityH1D(
   // std::cout<<variable<<" "<<varName<<" "<<varFilter<<endl;
   
   auto filterOut =
-    [&filterVector = filterVector, varName, nameSig] (int exp, int run, int evt, double indx)
+    [&filterVector = filterVector, &reserve = m_purityReserve, varName, nameSig] (int exp, int run, int evt, double indx)
     {
       filterElement element = std::make_tuple(exp, run, evt, indx);
 
@@ -151,7 +165,7 @@ SigBkgPlotter::TRRes1D SigBkgPlotter::PurityH1D(
       auto isVarPresent = filterVector.find(isK3pi.Data());
       if(isVarPresent == filterVector.end()) {
 	filterVector[isK3pi.Data()] = {element};
-	filterVector[isK3pi.Data()].reserve(10000000);
+	filterVector[isK3pi.Data()].reserve(reserve);
 	return true;
       }
       
@@ -187,11 +201,12 @@ SigBkgPlotter::TRRes1D SigBkgPlotter::PurityH1D(
     expr = TString::Format("%s*%.18lg", variable, scale);
   }
   TRRes1D res = make_tuple(
-    m_sig.Define("h1dtmp", expr.Data()).Histo1D({nameSig, titleSig, nBins, xLow, xUp}, "h1dtmp"),
-    m_all.Define("h1dtmp", expr.Data())
-    .Filter(filterOut,{"__experiment__","__run__","__event__",varFilter.Data()})
-    .Histo1D({nameMC, titleMC, nBins, xLow, xUp}, "h1dtmp"));
+    CachedHisto1D(CachedDefine(m_sig, "h1dtmp", expr), {nameSig, titleSig, nBins, xLow, xUp}, "h1dtmp"),
+    CachedHisto1D(CachedDefine(m_all, "h1dtmp", expr)
+                  .Filter(filterOut,{"__experiment__","__run__","__event__",varFilter.Data()}),
+                  {nameMC, titleMC, nBins, xLow, xUp}, "h1dtmp"));
 
+  m_registry.Add(MakeHistoKey(HistoKind::Purity, variable, "", nBins, xLow, xUp), nameSig, m_purityh1s.size());
   m_purityh1s.push_back(res);
   return res;
 }
@@ -230,20 +245,64 @@ void SigBkgPlotter::PrintAll(bool saveEff)
     if (get<1>(t))
       DrawSigBkg(t);
   for (const auto& t : m_h2s)
-    DrawSigBkg(t);
+    if (get<1>(t))
+      DrawSigBkg(t);
   for (const auto& t : m_effh1s)
     DrawEff(t, saveEff);
   for (const auto& t : m_purityh1s)
     DrawEff(t, saveEff);
 }
 
+Footprint SigBkgPlotter::GetFootprint(ULong64_t candidates) const
+{
+  Footprint fp;
+  set<TString> purityParticles; // One event list each
+  for (const auto& e : m_registry.GetEntries()) {
+    const HistoKey& k = e.key;
+    int n = 2; // The pair
+    if (k.kind == HistoKind::H1 && !get<1>(m_h1s[e.index])) n = 1;
+    if (k.kind == HistoKind::H2 && !get<1>(m_h2s[e.index])) n = 1;
+    // Each slot fills its own copy
+    fp.perSlot += n * HistoBytes(k.xBins, k.kind == HistoKind::H2 ? k.yBins : 0);
+    if (k.kind == HistoKind::H1 && m_autoRange) // The entries, buffered until the end of the loop
+      fp.fixed += n * candidates * sizeof(double);
+    if (k.kind == HistoKind::Purity)
+      purityParticles.insert(k.particle);
+  }
+  fp.eventLists = purityParticles.size();
+  fp.eventListEntries = fp.eventLists * candidates;
+  return fp;
+}
+
+vector<TH1*> SigBkgPlotter::GetAllHistos()
+{
+  vector<TH1*> res;
+  for (auto& t : m_h1s) {
+    res.push_back(get<0>(t).GetPtr());
+    if (get<1>(t)) res.push_back(get<1>(t).GetPtr());
+  }
+  for (auto& t : m_h2s) {
+    res.push_back(get<0>(t).GetPtr());
+    if (get<1>(t)) res.push_back(get<1>(t).GetPtr());
+  }
+  for (auto& t : m_effh1s) {
+    res.push_back(get<0>(t).GetPtr());
+    res.push_back(get<1>(t).GetPtr());
+  }
+  for (auto& t : m_purityh1s) {
+    res.push_back(get<0>(t).GetPtr());
+    res.push_back(get<1>(t).GetPtr());
+  }
+  return res;
+}
+
 void SigBkgPlotter::DrawSigBkg(TH1 *sig, TH1 *bkg)
 {
   CHECK(sig);
   {
     TString name = sig->GetName();
     if(name.Contains("Residual")) {
-      sig->Write();}
+      WriteResult(sig);}
   }
   if (!bkg) return;
   if (sig->GetDimension() == 2) {
@@ -405,68 +464,111 @@ void SigBkgPlotter::DrawEff(TH1* sig, TH1* mc, bool save)
   if (save) {
     TString newname = name.ReplaceAll("_effSig_", "_eff_");
     newname = newname.ReplaceAll("_puritySig_", "_purity_");
-    eff->Write(newname);
+    WriteResult(eff, newname);
     name = mc->GetName();
     newname = name.ReplaceAll("_effMC_", "_MC_");
     newname = newname.ReplaceAll("_purityAll_", "_All_");
-    mc->Write(newname);
+    WriteResult(mc, newname);
   }
 }
 
-void SigBkgPlotter::FitAndPrint(
-  TString name, const char* func, std::initializer_list<std::pair<TString,double>> p0)
+size_t SigBkgPlotter::FindIndex(TString name, HistoKind kind) const
 {
-  TH1* h = nullptr;
   name = m_namePrefix + "_sig_" + name;
-  for (auto& t : m_h1s) {
-    if (get<0>(t)->GetName() == name) {
-      h = get<0>(t).GetPtr();
-      break;
+  const auto* entry = m_registry.Find(name);
+  CHECKA(entry && entry->key.kind == kind, name);
+  return entry->index;
+}
+
+TH1* SigBkgPlotter::FindSigHisto(TString name)
+{
+  return get<0>(m_h1s[FindIndex(name, HistoKind::H1)]).GetPtr();
+}
+
+TH1* SigBkgPlotter::GetHisto(const HistoKey& key, bool second)
+{
+  const auto* entry = m_registry.Find(key);
+  if (!entry) return nullptr;
+  switch (key.kind) {
+    case HistoKind::H1: {
+      auto& t = m_h1s[entry->index];
+      return second ? (get<1>(t) ? get<1>(t).GetPtr() : nullptr) : get<0>(t).GetPtr();
+    }
+    case HistoKind::H2: {
+      auto& t = m_h2s[entry->index];
+      return second ? (get<1>(t) ? get<1>(t).GetPtr() : nullptr) : get<0>(t).GetPtr();
+    }
+    case HistoKind::Eff: {
+      auto& t = m_effh1s[entry->index];
+      return second ? get<1>(t).GetPtr() : get<0>(t).GetPtr();
+    }
+    case HistoKind::Purity: {
+      auto& t = m_purityh1s[entry->index];
+      return second ? get<1>(t).GetPtr() : get<0>(t).GetPtr();
     }
   }
-  CHECKA(h, name);
-  SetColor(h, kBlack, MyBlue);
+  return nullptr;
+}
+
+void SigBkgPlotter::FitAndPrint(
+  TString name, const char* func, std::initializer_list<std::pair<TString,double>> p0)
+{
+  TH1* h = FindSigHisto(name);
+  FitScheduler fits;
+  fits.Schedule(h, func, p0);
+  fits.RunAll(1);
+  DrawFit(h, *fits.GetFunction(h), fits.GetResult(h)->status);
+}
+
+void SigBkgPlotter::ScheduleFit(
+  FitScheduler& fits, TString name, const char* func, std::initializer_list<std::pair<TString,double>> p0)
+{
+  TH1* h = FindSigHisto(name);
+  fits.Schedule(h, func, p0);
+  m_fitted.push_back(h);
+}
+
+void SigBkgPlotter::PrintFits(const FitScheduler& fits)
+{
+  for (TH1* h : m_fitted) {
+    TF1* ff = fits.GetFunction(h);
+    CHECKA(ff, h->GetName());
+    DrawFit(h, *ff, fits.GetResult(h)->status);
+  }
+}
 
-  TF1 ff("ff", func, h->GetBinLowEdge(1), h->GetBinLowEdge(h->GetNbinsX() + 1), TF1::EAddToList::kNo);
-  for (const auto& pp0 : p0)
-    ff.SetParameter(pp0.first, pp0.second);
+void SigBkgPlotter::DrawFit(TH1* h, TF1& ff, int status)
+{
+  SetColor(h, kBlack, MyBlue);
   ff.SetLineColor(MyRed);
   ff.SetLineWidth(2);
   ff.SetNpx(500);
 
   m_c->cd();
   h->Draw();
-  h->Fit(&ff, "QI");
+  if (status >= 0) ff.Draw("same");
 
   TLegend leg(0.8, 0.8, 0.95, 0.91);
   leg.AddEntry(h, "Signal", "F");
   leg.AddEntry(&ff, "Fit function", "L");
   leg.Draw();
 
-  TPaveText fr(0.77, 0.79 - 0.055 * (ff.GetNpar() + 1), 0.98, 0.79, "brNDC");
+  TPaveText fr(0.77, 0.79 - 0.055 * (ff.GetNpar() + (status == 0 ? 1 : 2)), 0.98, 0.79, "brNDC");
   for (int i = 0; i < ff.GetNpar(); i++)
     fr.AddText(FormatNumberWithError(ff.GetParName(i), ff.GetParameter(i), ff.GetParError(i)));
   fr.AddText(TString::Format("#chi^{2}/NDF = %.0lf/%d", ff.GetChisquare(), ff.GetNDF()));
+  if (status != 0)
+    fr.AddText(status < 0 ? "Not fitted"TS : TString::Format("Fit failed (%d)", status));
   SetPaveStyle(fr);
   fr.Draw();
 
   if (m_logScale) m_c->SetLogy();
   m_c.PrintPage(h->GetTitle());
-
-  h->GetListOfFunctions()->Delete();
 }
 
 void SigBkgPlotter::SigmaAndPrint(TString name, double N, int rebin, bool showLowHigh)
 {
-  TH1* h = nullptr;
-  name = m_namePrefix + "_sig_" + name;
-  for (auto& t : m_h1s) {
-    if (get<0>(t)->GetName() == name) {
-      h = get<0>(t).GetPtr();
-      break;
-    }
-  }
-  CHECKA(h, name);
+  TH1* h = FindSigHisto(name);
 
   // Find sigmaN interval
   const double samples = h->GetEntries();
@@ -530,17 +632,11 @@ void SigBkgPlotter::SigmaAndPrint(TString name, double N, int rebin, bool showLo
   if (rebin > 1) delete hc;
 }
 
-void SigBkgPlotter::SigmaAndWrite(TString name, TString yunit, double N, double scale, bool isDiv)
+void SigBkgPlotter::SigmaAndWrite(TString name, TString yunit, double N, double scale, bool isDiv,
+                                  int quantileBins)
 {
-  TH2* h = nullptr;
-  name = m_namePrefix + "_sig_" + name;
-  for (auto& t : m_h2s) {
-    if (get<0>(t)->GetName() == name) {
-      h = get<0>(t).GetPtr();
-      break;
-    }
-  }
-  CHECKA(h, name);
+  TH2* h = get<0>(m_h2s[FindIndex(name, HistoKind::H2)]).GetPtr();
+  name = h->GetName();
 
   TString name1 = name + TString::Format("_sigma%.0f",N);
   TString name2 = name + TString::Format("_MC%.0f",N);
@@ -548,22 +644,47 @@ void SigBkgPlotter::SigmaAndWrite(TString name, TString yunit, double N, double
   TH1D* hprofX = (TH1D*)h->ProjectionX(name2);
   hprofX->SetTitle(h->GetTitle());
   hprofX->GetXaxis()->SetTitle(h->GetXaxis()->GetTitle());
-  hprofX->Write();
-
-  int nbinx = h->GetNbinsX();
-  double xmin = h->GetXaxis()->GetBinLowEdge(1);
-  double xmax = (h->GetXaxis()->GetBinLowEdge(nbinx) +
-		 h->GetXaxis()->GetBinWidth(1));
-  cout<<" "<<name<<" "<<nbinx<<" "<<xmin<<" "<<xmax<<endl;
-  TH1D* hprof = new TH1D(name1,h->GetTitle(),nbinx,xmin,xmax);
+  WriteResult(hprofX);
+
+  // Output bins as ranges of x bins of h: one x bin each, or merged into
+  // quantileBins bins with the same number of entries (equal population)
+  vector<int> firstBins, lastBins;
+  vector<double> edges {h->GetXaxis()->GetBinLowEdge(1)};
+  if (quantileBins > 0) {
+    const int nFine = h->GetNbinsX();
+    const double total = hprofX->Integral(1, nFine);
+    double accu = 0.0;
+    int first = 1;
+    for (int i = 1; i <= nFine; i++) {
+      accu += hprofX->GetBinContent(i);
+      // A bin is closed when it reaches the next quantile, the last one takes the rest
+      const bool full = accu >= total * (firstBins.size() + 1) / quantileBins;
+      if ((full && (int)firstBins.size() < quantileBins - 1) || i == nFine) {
+        firstBins.push_back(first);
+        lastBins.push_back(i);
+        edges.push_back(h->GetXaxis()->GetBinUpEdge(i));
+        first = i + 1;
+      }
+    }
+  } else {
+    for (int i = 1; i <= h->GetNbinsX(); i++) {
+      firstBins.push_back(i);
+      lastBins.push_back(i);
+      edges.push_back(h->GetXaxis()->GetBinUpEdge(i));
+    }
+  }
+
+  int nbinx = firstBins.size();
+  cout<<" "<<name<<" "<<nbinx<<" "<<edges.front()<<" "<<edges.back()<<endl;
+  TH1D* hprof = new TH1D(name1,h->GetTitle(),nbinx,edges.data());
   hprof->GetXaxis()->SetTitle(h->GetXaxis()->GetTitle());
   TString yname = TString::Format("#sigma_{%.0f} %s",N,yunit.Data());
   if(isDiv) {yname = TString::Format("#sigma_{%.0f}/x-value %s",N,yunit.Data());}
   hprof->GetYaxis()->SetTitle(yname);
 
   for(int ijn=0;ijn<nbinx;ijn++) {
-    TH1D *h1 = (TH1D*)h->ProjectionY("",ijn+1,ijn+1);
-    if(h1->GetSumOfWeights()<50) {continue;}
+    TH1D *h1 = (TH1D*)h->ProjectionY("",firstBins[ijn],lastBins[ijn]);
+    if(h1->GetSumOfWeights()<SigmaMinEntries) {continue;}
     
     // Find sigmaN interval
     double samples = h1->GetEntries();
@@ -583,7 +704,11 @@ void SigBkgPlotter::SigmaAndWrite(TString name, TString yunit, double N, double
     // double xCenter = (xUp + xLow) / 2.0;
     double xErr = h1->GetBinWidth(1);
     if(isDiv) {
-      double bincntr = h->GetXaxis()->GetBinCenter(ijn+1);
+      double bincntr = hprof->GetXaxis()->GetBinCenter(ijn+1);
+      if (quantileBins > 0) { // Wide bins, use the mean
+        hprofX->GetXaxis()->SetRange(firstBins[ijn], lastBins[ijn]);
+        bincntr = hprofX->GetMean();
+      }
       xWidth /= bincntr;
       // xErr   /= bincntr;
     }
@@ -596,28 +721,33 @@ void SigBkgPlotter::SigmaAndWrite(TString name, TString yunit, double N, double
   hprof->SetLineWidth(2);
   hprof->Draw();
 
-  hprof->Write();
+  WriteResult(hprof);
   
   m_c.PrintPage(hprof->GetTitle());
   delete hprof; delete hprofX;
 }
 
+double SigBkgPlotter::GetSigmaPrecision(TString name)
+{
+  TH2* h = get<0>(m_h2s[FindIndex(name, HistoKind::H2)]).GetPtr();
+  double worst = 0;
+  for (int i = 1; i <= h->GetNbinsX(); i++) {
+    const double n = h->Integral(i, i, 1, h->GetNbinsY()); // As the projection in SigmaAndWrite
+    if (n >= SigmaMinEntries)
+      worst = TMath::Max(worst, 1 / TMath::Sqrt(n));
+  }
+  return worst > 0 ? worst : 1;
+}
+
 void SigBkgPlotter::PrintROC(TString name, bool keepLow, bool excludeOUF)
 {
   static double linePoints[2] = {0.0, 100.0};
   static TGraph gLine(2, linePoints, linePoints);
 
-  TH1* sig = nullptr;
-  TH1* bkg = nullptr;
-  name = m_namePrefix + "_sig_" + name;
-  for (auto& t : m_h1s) {
-    if (get<0>(t)->GetName() == name) {
-      sig = get<0>(t).GetPtr();
-      bkg = get<1>(t) ? nullptr : get<1>(t).GetPtr();
-      break;
-    }
-  }
-  CHECKA(sig, name);
+  auto& t = m_h1s[FindIndex(name, HistoKind::H1)];
+  TH1* sig = get<0>(t).GetPtr();
+  TH1* bkg = get<1>(t) ? get<1>(t).GetPtr() : nullptr;
+  name = sig->GetName();
   CHECKA(bkg, name);
 
   // Build ROC curve
@@ -1,17 +1,24 @@
 #pragma once
 #include "PDFCanvas.hh"
+#include "HistoRegistry.hh"
+#include "MemoryBudget.hh"
+#include "Constants.hh"
+#include "JitCache.hh"
 #include <TString.h>
 #include <ROOT/RDataFrame.hxx>
 #include <tuple>
 #include <vector>
+// Forward declarations
+class FitScheduler;
+class TF1;
 
 /** Utility class to make plots where signal and background events are
  * overlayed.
  */
 class SigBkgPlotter {
  public:
-  typedef ROOT::RDF::RInterface<ROOT::Detail::RDF::RJittedFilter,void> FilterDF;
-  typedef ROOT::RDF::RInterface<ROOT::Detail::RDF::RLoopManager,void> DefineDF;
+  typedef ROOT::RDF::RNode FilterDF; /**< The filters, jitted or compiled (see JitCache.hh). */
+  typedef ROOT::RDF::RNode DefineDF; /**< The defines, possibly after the event sampling. */
   typedef ROOT::RDF::RResultPtr<TH1D> RRes1D;
   typedef std::tuple<RRes1D,RRes1D> TRRes1D;
   typedef ROOT::RDF::RResultPtr<TH2D> RRes2D;
@@ -27,29 +34,18 @@ class SigBkgPlotter {
   /** Constructor for a SigBkgPlotter that takes data from df, uses sigCond to
    * tell signal from background and prints plots to c.
    */
-  SigBkgPlotter(DefineDF& df, DefineDF& mcdf, TString sigCond, PDFCanvas& c,
+  SigBkgPlotter(DefineDF df, DefineDF mcdf, TString sigCond, PDFCanvas& c,
                 TString namePrefix = "undefined", TString titlePrefix = "Undefined",
                 bool normalizeHistos = false, bool logScale = false)
-  : m_all(df.Filter("true", "AllCandidates")),
-    m_sig(df.Filter((const char*)sigCond, "Signal")),
-    m_bkg(df.Filter((const char*)("!(" + sigCond + ")"), "Background")),
-    m_mc(mcdf), m_c(c), m_namePrefix(namePrefix), m_titlePrefix(titlePrefix),
-    m_normalizeHistos(normalizeHistos), m_logScale(logScale) {}
-
-  /** Constructor for a SigBkgPlotter that takes data from df, uses sigCond to
-   * tell signal from background and prints plots to c.
-   */
-  SigBkgPlotter(FilterDF& df, DefineDF& mcdf, TString sigCond, PDFCanvas& c,
-                TString namePrefix = "undefined", TString titlePrefix = "Undefined",
-                bool normalizeHistos = false, bool logScale = false)
-  : m_all(df.Filter("true", "AllCandidates")),
-    m_sig(df.Filter((const char*)sigCond, "Signal")),
-    m_bkg(df.Filter((const char*)("!(" + sigCond + ")"), "Background")),
+  : m_all(CachedFilter(df, "true", "AllCandidates")),
+    m_sig(CachedFilter(df, sigCond, "Signal")),
+    m_bkg(CachedFilter(df, "!(" + sigCond + ")", "Background")),
     m_mc(mcdf), m_c(c), m_namePrefix(namePrefix), m_titlePrefix(titlePrefix),
     m_normalizeHistos(normalizeHistos), m_logScale(logScale) {}
 
   /** Makes a tuple {sig,bkg} of histograms of the given variable.
    * The tuple is returned and saved to the interal list of plots.
+   * With SetAutoRange(true), sig and bkg share a range decided in the loop.
    * @param scale Multiplies variable by this number before filling
    * @param sigOnly Only make signal histogram (PrintAll will skip it)
    */
@@ -67,10 +63,11 @@ class SigBkgPlotter {
 
   /** Makes a tuple {sig,bkg} of 2D histograms of the given variables.
    * The tuple is returned and saved to the interal list of plots.
+   * @param sigOnly Only make signal histogram (PrintAll will skip it)
    */
   TRRes2D Histo2D(const char* vx, const char* vy, TString title,
                   int xBins, double xLow, double xUp,
-                  int yBins, double yLow, double yUp);
+                  int yBins, double yLow, double yUp, bool sigOnly = false);
 
   /** Makes a tuple {sig,bkg} of 2D histograms of the given variables
    * for each of the given particles. In title, $p is replaced with the
@@ -79,7 +76,7 @@ class SigBkgPlotter {
   void Histo2D(std::initializer_list<TString> particles,
                const char* vx, const char* vy, TString title,
                int xBins, double xLow, double xUp,
-               int yBins, double yLow, double yUp);
+               int yBins, double yLow, double yUp, bool sigOnly = false);
 
   /** Makes a tuple {sig,mc} of histograms of the given variable.
    * The tuple is returned and saved in the internal list of plots.
@@ -119,6 +116,16 @@ class SigBkgPlotter {
   void FitAndPrint(TString name, const char* func,
                    std::initializer_list<std::pair<TString,double>> p0 = {});
 
+  /** Like FitAndPrint, but the fit is only scheduled in fits, to be run
+   * concurrently with the others (FitScheduler::RunAll). The page is printed
+   * by PrintFits.
+   */
+  void ScheduleFit(FitScheduler& fits, TString name, const char* func,
+                   std::initializer_list<std::pair<TString,double>> p0 = {});
+
+  /** Prints the fits scheduled with ScheduleFit (after fits.RunAll). */
+  void PrintFits(const FitScheduler& fits);
+
   /** Finds the *signal* histogram called name and finds the sigmaN of
    * the distribution (the half-width that contains N% of the samples,
    * with half of the remainder on each side).
@@ -133,8 +140,17 @@ class SigBkgPlotter {
    * the distribution (the half-width that contains N% of the samples,
    * with half of the remainder on each side).
    * @param N The percentage of samples in the half-width (default 68%)
+   * @param quantileBins If not 0, the x bins of the histogram are merged
+   *        into this number of bins with the same number of entries
+   */
+  void SigmaAndWrite(TString name, TString yunit, double N = 68.0, double scale = 1., bool isDiv = false,
+                     int quantileBins = 0);
+
+  /** Returns the worst relative statistical precision of the sigmaN values
+   * of SigmaAndWrite(name, ...) with one x bin each: about 1/sqrt(entries)
+   * of the bin, for the bins with a sigmaN. 1 if there are none yet.
    */
-  void SigmaAndWrite(TString name, TString yunit, double N = 68.0, double scale = 1., bool isDiv = false);
+  double GetSigmaPrecision(TString name);
 
   /** Finds the signal and backgound histograms called name and produces
    * the ROC curve plot for a cut var < threshold (if keepLow is true)
@@ -153,6 +169,27 @@ class SigBkgPlotter {
    */
   void PrintAll(bool saveEff = false);
 
+  /** Returns the histogram with the given key (see MakeHistoKey), or nullptr
+   * if there is none: the first one of the pair (sig, effSig, ...), or the
+   * second one (bkg, effMC, ...) if second is true.
+   */
+  TH1* GetHisto(const HistoKey& key, bool second = false);
+
+  /** The index of all the histograms booked up to now, in booking order. */
+  const HistoRegistry& GetRegistry() const { return m_registry; }
+
+  /** Estimated memory of the histograms booked up to now, and of the
+   * PurityH1D event lists (one per particle).
+   * @param candidates Expected candidates of the loop, at most one entry of
+   * each event list each
+   */
+  Footprint GetFootprint(ULong64_t candidates) const;
+
+  /** Returns all the histograms booked up to now (sig, bkg, mc, ...).
+   * Triggers the event loop if it has not run yet.
+   */
+  std::vector<TH1*> GetAllHistos();
+
   TString GetNamePrefix() const { return m_namePrefix; }
   void SetNamePrefix(TString namePrefix) { m_namePrefix = namePrefix; }
 
@@ -165,6 +202,16 @@ class SigBkgPlotter {
   bool GetLogScale() const { return m_logScale; }
   void SetLogScale(bool value) { m_logScale = value; }
 
+  size_t GetPurityReserve() const { return m_purityReserve; }
+  /** Initial size of the PurityH1D event lists (set before the event loop). */
+  void SetPurityReserve(size_t value) { m_purityReserve = value; }
+
+  bool GetAutoRange() const { return m_autoRange; }
+  /** Books the next Histo1D with a range decided in the event loop (see
+   * AutoRange), their xLow and xUp being only used if there are no entries.
+   */
+  void SetAutoRange(bool value) { m_autoRange = value; }
+
   bool GetBkgDownScaleFactor() const { return m_bkgDownScale; }
   /** 0 For no scaling, 1 (default) for auto, any number for fixed. */
   void SetBkgDownScaleFactor(int value) { m_bkgDownScale = value; }
@@ -179,6 +226,17 @@ class SigBkgPlotter {
   inline void DrawSigBkg(RRes2D sig, RRes2D bkg) { DrawSigBkg(sig.GetPtr(), bkg.GetPtr()); }
   inline void DrawSigBkg(TRRes2D tuple) { DrawSigBkg(std::get<0>(tuple), std::get<1>(tuple)); }
 
+  /** Prints a signal histogram with its fitted function to PDF. */
+  void DrawFit(TH1* h, TF1& ff, int status);
+
+  /** Returns the index in the list of kind of the histogram whose signal
+   * histogram is called name (without prefix). Throws if there is none.
+   */
+  size_t FindIndex(TString name, HistoKind kind) const;
+
+  /** Finds the *signal* 1D histogram called name (without prefix). */
+  TH1* FindSigHisto(TString name);
+
   /** Prints an efficiency histogram to PDF. */
   void DrawEff(TH1* sig, TH1* mc, bool save = false);
   inline void DrawEff(RRes1D sig, RRes1D mc, bool save = false) { DrawEff(sig.GetPtr(), mc.GetPtr(), save); }
@@ -193,12 +251,16 @@ class SigBkgPlotter {
   std::vector<TRRes2D> m_h2s; /**< 1D histograms go here. */
   std::vector<TRRes1D> m_effh1s; /**< 1D efficiency histograms go here. */
   std::vector<TRRes1D> m_purityh1s; /**< 1D purity histograms go here. */
+  std::vector<TH1*> m_fitted; /**< Signal histograms with a scheduled fit. */
+  HistoRegistry m_registry; /**< Where the histograms of m_h1s, m_h2s, ... are. */
   TString m_namePrefix; /**< Prefix for the name of the histograms. */
   TString m_titlePrefix; /**< Prefix for the title of the histograms. */
   bool m_normalizeHistos; /**< Used by DrawSigBkg to decide wether to normalize histograms. */
   bool m_logScale; /**< Histograms y (or z) axis with log scale. */
   int m_bkgDownScale = 1; /**< Down-scaling factor for bkg (for visibility of sig). */
   bool m_histsAlreadyNormalized = false;
+  size_t m_purityReserve = PurityReserve; /**< See SetPurityReserve. */
+  bool m_autoRange = false; /**< See SetAutoRange. */
 
   std::map<std::string, std::vector<filterElement>> filterVector;
   // const int maxCount = 10;
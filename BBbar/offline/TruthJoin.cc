@@ -0,0 +1,88 @@
+#include "TruthJoin.hh" // Own include
+#include "EventJoin.hh"
+#include "Utils.hh"
+#include "ResultWriter.hh"
+#include <TH1.h>
+#include <TMath.h>
+#include <iostream>
+#include <memory>
+using namespace std;
+
+// Columns read by the join, in this order
+enum RecoColumn { kRecoIsSignal, kRecoB0mcP, kRecoDstp, kRecoDstmcP };
+enum MCColumn { kMCB0mcP, kMCDstmcP };
+
+TruthJoinHistos TruthJoinAnalysis(const vector<string>& files, bool isK3pi, TString namePrefix, int nThreads)
+{
+  const TString cht = isK3pi ? "K3#pi - " : "K#pi - ";
+  TruthJoinHistos res {
+    new TH1D(GetUniqueName(namePrefix + "_nSigPerMC"),
+             cht + "Signal candidates per MC B^{0};Signal candidates;MC B^{0}", 10, -0.5, 9.5),
+    new TH1D(GetUniqueName(namePrefix + "_mcP_all"),
+             cht + "MC B^{0};True p_{B^{0}} [GeV/c];MC B^{0} / bin", 20, 1, 2),
+    new TH1D(GetUniqueName(namePrefix + "_mcP_found"),
+             cht + "MC B^{0} with a signal candidate;True p_{B^{0}} [GeV/c];MC B^{0} / bin", 20, 1, 2),
+    new TH1D(GetUniqueName(namePrefix + "_DstpResidual"),
+             cht + "p_{D*} residual (truth from the MC B^{0});Reco - true [MeV/c];Candidates / bin", 100, -50, 50)
+  };
+  for (TH1D* h : res.All())
+    h->SetDirectory(nullptr);
+
+  // One copy of the histograms per slot, added at the end
+  vector<vector<unique_ptr<TH1D>>> slots(nThreads);
+  for (auto& slot : slots) {
+    for (TH1D* h : res.All()) {
+      slot.emplace_back((TH1D*)h->Clone());
+      slot.back()->SetDirectory(nullptr);
+    }
+  }
+
+  EventJoin join(files, isK3pi ? "K3pi" : "Kpi", isK3pi ? "MCK3pi" : "MCKpi", nThreads);
+  join.Run(nThreads,
+    {"B0_isSignalAcceptMissingNeutrino", "B0_mcP", "Dst_p", "Dst_mcP"}, // RecoColumn
+    {"B0_mcP", "Dst_mcP"}, // MCColumn
+    [&slots](unsigned int iSlot, const JoinedEvent& evt) {
+      auto& h = slots[iSlot]; // In the order of TruthJoinHistos::All
+      for (size_t m = 0; m < evt.NMC(); m++) {
+        const double mcP = evt.MC(m, kMCB0mcP);
+        int nSig = 0;
+        for (size_t r = 0; r < evt.NReco(); r++) {
+          // Same as SignalCondition, and the same true B (same true momentum)
+          if (evt.Reco(r, kRecoIsSignal) != 1.0) continue;
+          if (TMath::Abs(evt.Reco(r, kRecoB0mcP) - mcP) > 1e-9 * (1 + mcP)) continue;
+          nSig++;
+          h[3]->Fill((evt.Reco(r, kRecoDstp) - evt.MC(m, kMCDstmcP)) * 1e3);
+        }
+        h[0]->Fill(nSig);
+        h[1]->Fill(mcP);
+        if (nSig > 0) h[2]->Fill(mcP);
+      }
+    });
+
+  const auto all = res.All();
+  for (const auto& slot : slots)
+    for (size_t i = 0; i < all.size(); i++)
+      all[i]->Add(slot[i].get());
+  return res;
+}
+
+void DoTruthJoin(const TruthJoinHistos& h, TString title)
+{
+  TH1* hEff = ComputeEfficiency(h.mcPFound, h.mcPAll);
+  TString name = h.mcPFound->GetName();
+  hEff->SetName(name.ReplaceAll("_found", "_eff"));
+  hEff->SetTitle(title + " - Efficiency per MC B^{0};True p_{B^{0}} [GeV/c];Efficiency");
+  for (TH1* hh : h.All())
+    WriteResult(hh);
+  WriteResult(hEff);
+  delete hEff;
+
+  // Bin 1 = no signal candidate, bins > 2 = duplicates
+  const double nMC = h.nSigPerMC->GetEntries();
+  const double nLost = h.nSigPerMC->GetBinContent(1);
+  const double nDup = h.nSigPerMC->Integral(3, h.nSigPerMC->GetNbinsX() + 1);
+  TString fs;
+  fs.Form("%s per MC B: %.0f MC B, %.4g%% with a signal candidate, %.4g%% with more than one", title.Data(),
+          nMC, nMC == 0 ? 0.0 : 100.0 * (nMC - nLost) / nMC, nMC == 0 ? 0.0 : 100.0 * nDup / nMC);
+  cout << fs << endl;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "Constants.hh"
+#include <TString.h>
+#include <string>
+#include <vector>
+class TH1D; // Forward declaration
+
+/** Histograms of the per-true-B analysis of a channel (see TruthJoinAnalysis),
+ * all of them mergeable with TH1::Add.
+ */
+typedef struct TruthJoinHistos {
+  TH1D* nSigPerMC;    /**< Signal candidates per MC B (0 = lost, > 1 = duplicates). */
+  TH1D* mcPAll;       /**< True p of all the MC B. */
+  TH1D* mcPFound;     /**< True p of the MC B with at least one signal candidate. */
+  TH1D* DstpResidual; /**< Reco - true p of the D* of the signal candidates. */
+
+  std::vector<TH1D*> All() const { return {nSigPerMC, mcPAll, mcPFound, DstpResidual}; }
+} TruthJoinHistos;
+
+/** Joins the candidates of a channel with the MC B they come from (see
+ * EventJoin): a signal candidate belongs to the MC B of the same event with
+ * the same true momentum. Each MC B is counted once, however many signal
+ * candidates it has (unlike the EffH1D efficiencies).
+ * This is an instant action, run on nThreads threads.
+ */
+TruthJoinHistos TruthJoinAnalysis(const std::vector<std::string>& files, bool isK3pi, TString namePrefix,
+                                  int nThreads = NThreads);
+
+/** Writes the histograms and the per-true-B efficiency vs p to the current
+ * directory, and prints the efficiency and the duplicate rate.
+ */
+void DoTruthJoin(const TruthJoinHistos& h, TString title);
@@ -1,18 +1,32 @@
 #include "Utils.hh" // Own include
 #include <TH2.h>
 #include <TMath.h>
-#include <map>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 using namespace std;
 
+static unordered_map<string,int> UniqueNames;
+static mutex UniqueNamesMutex; // Plotters may be booked concurrently
+
 TString GetUniqueName(TString baseName)
 {
-  static map<TString,int> names;
-  int n = ++names[baseName];
+  int n;
+  {
+    lock_guard<mutex> lock(UniqueNamesMutex);
+    n = ++UniqueNames[baseName.Data()];
+  }
   if (n == 1) return baseName;
   return TString::Format("%s_%d", baseName.Data(), n);
 }
 
+void ResetUniqueNames()
+{
+  lock_guard<mutex> lock(UniqueNamesMutex);
+  UniqueNames.clear();
+}
+
 TH2UO Get2DHistUnderOverFlows(TH1* h)
 {
   if (!h || h->GetDimension() != 2)
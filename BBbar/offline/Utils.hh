@@ -42,9 +42,15 @@ inline void Unnormalize(TH1* h) { if (h) h->Scale(h->GetEntries()); }
  *  - The second time, it returns the name + "_2"
  *  - The third time, it returns the name + "_3"
  *  - ...
+ * It can be called from several threads at once.
  */
 TString GetUniqueName(TString baseName);
 
+/** Forgets all the names given by GetUniqueName, so that booking the same
+ * histograms again gives them the same names as the first time.
+ */
+void ResetUniqueNames();
+
 /** Type for the 3x3 matrix with the under/over-flows of a 2D histo. */
 typedef struct TH2UO {
   Double_t xuyo; /**< X under, Y over */
@@ -0,0 +1,80 @@
+#include "VariationSet.hh" // Own include
+#include "Utils.hh"
+#include "ResultWriter.hh"
+#include "JitCache.hh"
+#include <TH1.h>
+#include <TMath.h>
+#include <TPRegexp.h>
+#include <iostream>
+using namespace std;
+
+UInt_t VariationCutMask(const vector<OfflineCut>& cuts, TString regex)
+{
+  if (regex.IsNull()) return 0;
+  CHECKA(cuts.size() <= 32, TString::Format("%zu cuts", cuts.size()));
+  TPRegexp re(regex);
+  UInt_t mask = 0;
+  for (size_t i = 0; i < cuts.size(); i++)
+    if (re.MatchB(cuts[i].name))
+      mask |= 1u << i;
+  return mask;
+}
+
+VariationSet::VariationSet(SigBkgPlotter::DefineDF& df, SigBkgPlotter::DefineDF& mcdf,
+                           const vector<Variation>& variations, const vector<OfflineCut>& cuts,
+                           PDFCanvas& c, TString namePrefix, TString titlePrefix)
+: m_variations(variations), m_namePrefix(namePrefix), m_titlePrefix(titlePrefix)
+{
+  for (const auto& v : m_variations) {
+    const UInt_t mask = VariationCutMask(cuts, v.cutsRegex);
+    const TString sigCond = v.sigCond.IsNull() ? SignalCondition : v.sigCond;
+    auto dfVar = CachedFilter(df, TString::Format("(offlineCutsMask & %uu) == %uu", mask, mask),
+                              "Variation " + v.name);
+    m_plotters.push_back(make_unique<SigBkgPlotter>(
+      dfVar, mcdf, sigCond, c, m_namePrefix + v.name, m_titlePrefix + " (" + v.title + ")"));
+    m_nSig.push_back(CachedFilter(dfVar, sigCond).Count());
+    m_nBkg.push_back(CachedFilter(dfVar, "!(" + sigCond + ")").Count());
+  }
+}
+
+vector<SigBkgPlotter*> VariationSet::GetPlotters()
+{
+  vector<SigBkgPlotter*> res;
+  for (const auto& plt : m_plotters)
+    res.push_back(plt.get());
+  return res;
+}
+
+vector<TH1*> VariationSet::GetAllHistos()
+{
+  if (!m_counts) {
+    const int n = m_variations.size();
+    m_counts = make_unique<TH1D>(GetUniqueName(m_namePrefix + "Variations_counts"),
+                                 m_titlePrefix + " - Variations;;Candidates", 2 * n, 0, 2 * n);
+    m_counts->SetDirectory(nullptr);
+    for (int i = 0; i < n; i++) {
+      m_counts->GetXaxis()->SetBinLabel(2 * i + 1, m_variations[i].name + " sig.");
+      m_counts->GetXaxis()->SetBinLabel(2 * i + 2, m_variations[i].name + " bkg.");
+      m_counts->SetBinContent(2 * i + 1, *m_nSig[i]);
+      m_counts->SetBinContent(2 * i + 2, *m_nBkg[i]);
+    }
+  }
+  return {m_counts.get()};
+}
+
+void VariationSet::Print(UInt_t nMC)
+{
+  TH1* h = GetAllHistos().front();
+  TString fs;
+  cout << m_titlePrefix << " selection variations" << endl;
+  cout << "   Variation                   |   Signal   | Background | Efficiency |   Purity   | S/sqrt(S+B)" << endl;
+  cout << "   ----------------------------+------------+------------+------------+------------+------------" << endl;
+  for (size_t i = 0; i < m_variations.size(); i++) {
+    const double s = h->GetBinContent(2 * i + 1), b = h->GetBinContent(2 * i + 2);
+    fs.Form("   %-28s|%12.0f|%12.0f|%11.4g%%|%11.4g%%|%12.4g", m_variations[i].title.Data(), s, b,
+            nMC == 0 ? 0.0 : 100.0 * s / nMC, s + b == 0 ? 0.0 : 100.0 * s / (s + b),
+            s + b == 0 ? 0.0 : s / TMath::Sqrt(s + b));
+    cout << fs << endl;
+  }
+  WriteResult(h);
+}
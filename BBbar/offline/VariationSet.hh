@@ -0,0 +1,53 @@
+#pragma once
+#include "SigBkgPlotter.hh"
+#include "Constants.hh"
+#include <memory>
+#include <vector>
+
+/** Returns the bitmask (see CutMaskExpression) of the cuts whose names match
+ * regex (a PCRE), 0 if regex is empty.
+ */
+UInt_t VariationCutMask(const std::vector<OfflineCut>& cuts, TString regex);
+
+/** A plotter booked on a list of selection variations at once: one
+ * SigBkgPlotter per variation, all branching off the same dataframe, so that
+ * they are filled in the same event loop, from the same column reads and
+ * the same derived columns. Each variation only adds a bitmask test on the
+ * "offlineCutsMask" column, and its own signal condition.
+ */
+class VariationSet {
+ public:
+  VariationSet() = delete;
+  VariationSet(const VariationSet&) = delete;
+  VariationSet(VariationSet&&) = delete;
+  VariationSet& operator=(const VariationSet&) = delete;
+  VariationSet& operator=(VariationSet&&) = delete;
+
+  /** Books a plotter per variation on df, which must have the
+   * "offlineCutsMask" column computed with cuts. The plotters print to c.
+   */
+  VariationSet(SigBkgPlotter::DefineDF& df, SigBkgPlotter::DefineDF& mcdf, const std::vector<Variation>& variations,
+               const std::vector<OfflineCut>& cuts, PDFCanvas& c, TString namePrefix, TString titlePrefix);
+
+  /** The plotters, in the order of the variations (book the plots on each). */
+  std::vector<SigBkgPlotter*> GetPlotters();
+
+  /** Prints the signal and background counts and the efficiency of each
+   * variation, and writes the counts histogram to the current directory.
+   * @param nMC Number of MC signal events, for the efficiencies
+   */
+  void Print(UInt_t nMC);
+
+  /** Returns the counts histogram (bins 2i+1 and 2i+2 are the signal and
+   * background of the i-th variation). Triggers the event loop.
+   */
+  std::vector<TH1*> GetAllHistos();
+
+ private:
+  std::vector<Variation> m_variations;
+  TString m_namePrefix;
+  TString m_titlePrefix;
+  std::vector<std::unique_ptr<SigBkgPlotter>> m_plotters;
+  std::vector<ROOT::RDF::RResultPtr<ULong64_t>> m_nSig, m_nBkg;
+  std::unique_ptr<TH1D> m_counts; /**< Filled from m_nSig and m_nBkg on first use. */
+};
@@ -4,25 +4,76 @@
 #include "ArgParser.hh"
 #include "CutEfficiency.hh"
 #include "Constants.hh"
+#include "ResultsStore.hh"
+#include "CandidateRanking.hh"
+#include "CutScan.hh"
+#include "CutFlow.hh"
+#include "FitScheduler.hh"
+#include "TruthJoin.hh"
+#include "EventJoin.hh"
+#include "VariationSet.hh"
+#include "AnaServer.hh"
+#include "MemoryBudget.hh"
+#include "InputPipeline.hh"
+#include "ResultWriter.hh"
+#include "ResolutionMap.hh"
+#include "NpyExport.hh"
+#include "CutOrder.hh"
+#include "JitCache.hh"
 #include <TString.h>
 #include <TStyle.h>
 #include <TCanvas.h>
 #include <ROOT/RDataFrame.hxx>
+#include <ROOT/RDFHelpers.hxx>
 #include <TFile.h>
+#include <TChain.h>
+#include <TMemFile.h>
+#include <TSystem.h>
+#include <TParameter.h>
+#include <TROOT.h>
+#include <THn.h>
 #include <iostream>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <chrono>
 using namespace std;
 using namespace ROOT;
 
+/** Operations of defineVarsForParticles. */
+enum class VarOp { Difference, Ratio, Product };
+
+/** Defines name = op(a, b), where a and b are double or float columns, with
+ * a compiled function instead of a jitted expression.
+ */
+template <class Op>
+SigBkgPlotter::DefineDF defineBinary(SigBkgPlotter::DefineDF df, const TString& name,
+                                     const TString& a, const TString& b, Op op)
+{
+  auto isFloat = [&df](const TString& col) {
+    const auto type = df.GetColumnType(col.Data());
+    return type == "float" || type == "Float_t"; // RNTuples (see ConvertToRNTuple.C)
+  };
+  const vector<string> cols {a.Data(), b.Data()};
+  if (isFloat(a) && isFloat(b))
+    return df.Define(name.Data(), [op](float x, float y) { return op(double(x), double(y)); }, cols);
+  if (isFloat(a))
+    return df.Define(name.Data(), [op](float x, double y) { return op(double(x), y); }, cols);
+  if (isFloat(b))
+    return df.Define(name.Data(), [op](double x, float y) { return op(x, double(y)); }, cols);
+  return df.Define(name.Data(), [op](double x, double y) { return op(x, y); }, cols);
+}
+
 /** For each particle and for each {aVar, bVar, newVar} tuple, this
  * function defines a new variable
- * "particle_newVar = f(particle_aVar,particle_bVar)"
- * where f is obtained by replacing "$a" and "$b" in exprTemplate
- * (which is "$a - $b" by default).
+ * "particle_newVar = particle_aVar op particle_bVar"
+ * where op is -, / or * (- by default). These are the bulk of the derived
+ * columns, so they are compiled rather than jitted.
  */
 SigBkgPlotter::DefineDF defineVarsForParticles(
   SigBkgPlotter::DefineDF source, initializer_list<TString> particles,
   initializer_list<TString> aVars, initializer_list<TString> bVars,
-  initializer_list<TString> newVars, TString exprTemplate = "$a - $b")
+  initializer_list<TString> newVars, VarOp op = VarOp::Difference)
 {
   auto df = source;
   for (const TString& p : particles) {
@@ -30,20 +81,26 @@ SigBkgPlotter::DefineDF defineVarsForParticles(
          av != aVars.end() && bv != bVars.end() && nv != newVars.end();
          av++, bv++, nv++) {
       TString pav = p + "_" + *av, pbv = p + "_" + *bv, pnv = p + "_" + *nv;
-      TString expr = exprTemplate;
-      expr = expr.ReplaceAll("$a", pav).ReplaceAll("$b", pbv);
-      df = df.Define(pnv.Data(), expr.Data());
-      // cout << pnv << " = " << expr << endl;
+      switch (op) {
+        case VarOp::Difference: df = defineBinary(df, pnv, pav, pbv, minus<double>()); break;
+        case VarOp::Ratio: df = defineBinary(df, pnv, pav, pbv, divides<double>()); break;
+        case VarOp::Product: df = defineBinary(df, pnv, pav, pbv, multiplies<double>()); break;
+      }
     }
   }
   return df;
 }
 
-/** Define expression variables. */
-SigBkgPlotter::DefineDF defineVariables(RDataFrame& df, bool isK3pi)
+/** True for the channel with three pions (offline cuts of K3pi). */
+template <class Ch>
+constexpr bool IsK3pi = std::is_same_v<Ch, K3piChannel>;
+
+/** Define expression variables of the channel Ch (see DecayChain.hh). */
+template <class Ch>
+SigBkgPlotter::DefineDF defineVariables(SigBkgPlotter::DefineDF df)
 {
-  const auto& CompParts = CompositeParticles;
-  const auto& FSParts = isK3pi ? K3PiFSParticles : KPiFSParticles;
+  const auto& CompParts = Ch::Composites::Names();
+  const auto& FSParts = Ch::FS::Names();
 
   auto ddf = defineVarsForParticles(df, CompParts,
     {"mcDecayVertexX", "mcDecayVertexY", "mcDecayVertexZ"},
@@ -53,7 +110,7 @@ SigBkgPlotter::DefineDF defineVariables(RDataFrame& df, bool isK3pi)
     {"residualDecayX", "residualDecayY", "residualDecayZ"},
     {"x_uncertainty",  "y_uncertainty",  "z_uncertainty"},
     {"pullDecayX", "pullDecayY", "pullDecayZ"},
-    "$a / $b");
+    VarOp::Ratio);
   ddf = defineVarsForParticles(ddf, {"D0"},
     {"mcFlightDistance",       "mcFlightTime"},
     {"flightDistance",         "flightTime"},
@@ -62,20 +119,19 @@ SigBkgPlotter::DefineDF defineVariables(RDataFrame& df, bool isK3pi)
     {"residualFlightDistance", "residualFlightTime"},
     {"flightDistanceErr",      "flightTimeErr"},
     {"pullFlightDistance",     "pullFlightTime"},
-    "$a / $b");
+    VarOp::Ratio);
   ddf = defineVarsForParticles(ddf, FSParts,
     {"d0Err",      "z0Err"},
     {"d0Pull",     "z0Pull"},
     {"d0Residual", "z0Residual"},
-    "$a * $b"); // Residuals from pulls, not straightforward but works
+    VarOp::Product); // Residuals from pulls, not straightforward but works
   ddf = defineVarsForParticles(ddf, FSParts,
     {"mcPT",       "mcP",        "mcTheta",       "mcPhi"},
     {"pt",         "p",          "theta",         "phi"},
     {"ptResidual", "pResidual",  "thetaResidual", "phiResidual"});
-  ddf = ddf.Define("B0_M_rank_percent", "(B0_M_rank - 1) * 100 / (__ncandidates__ == 1 ? 1 : __ncandidates__ - 1)")
-           .Define("B0_chiProb_rank_percent", "(B0_chiProb_rank - 1) * 100 / (__ncandidates__ == 1 ? 1 : __ncandidates__ - 1)")
-           .Define("Dst_dM_rank_percent", "(Dst_dM_rank - 1) * 100 / (__ncandidates__ == 1 ? 1 : __ncandidates__ - 1)")
-           .Define("D0_dM_rank_percent", "(D0_dM_rank - 1) * 100 / (__ncandidates__ == 1 ? 1 : __ncandidates__ - 1)");
+  for (const char* rank : {"B0_M_rank", "B0_chiProb_rank", "Dst_dM_rank", "D0_dM_rank"})
+    ddf = CachedDefine(ddf, rank + "_percent"TS,
+                       "("TS + rank + " - 1) * 100.0 / (__ncandidates__ == 1 ? 1 : __ncandidates__ - 1)");
   for (const TString& p : FSParts)
     ddf = ddf.Alias(
       (p + "_firstVXDLayer").Data(),
@@ -84,7 +140,7 @@ SigBkgPlotter::DefineDF defineVariables(RDataFrame& df, bool isK3pi)
     );
 
   // Define variables for piH and piL, which are pi1 and pi2 sorted by pT
-  if (isK3pi) {
+  if constexpr (Ch::Sorted) {
     for (const auto& sCol : df.GetColumnNames()) {
       TString col = sCol;
       if (!col.BeginsWith("pi1_")) continue;
@@ -93,35 +149,39 @@ SigBkgPlotter::DefineDF defineVariables(RDataFrame& df, bool isK3pi)
       newName.Form("piH_%s", col.Data());
       newExpr.Form("pi1_pt < pi2_pt ? pi2_%s : pi1_%s", col.Data(), col.Data());
       // cout << newName << " = " << newExpr << endl;
-      ddf = ddf.Define(newName.Data(), newExpr.Data());
+      ddf = CachedDefine(ddf, newName, newExpr);
       newName.Form("piL_%s", col.Data());
       newExpr.Form("pi1_pt < pi2_pt ? pi1_%s : pi2_%s", col.Data(), col.Data());
       // cout << newName << " = " << newExpr << endl;
-      ddf = ddf.Define(newName.Data(), newExpr.Data());
+      ddf = CachedDefine(ddf, newName, newExpr);
     }
     ddf = defineVarsForParticles(ddf, {"piH", "piL"},
       {"d0Err",      "z0Err"},
       {"d0Pull",     "z0Pull"},
       {"d0Residual", "z0Residual"},
-      "$a * $b"); // Residuals from pulls, not straightforward but works
+      VarOp::Product); // Residuals from pulls, not straightforward but works
     ddf = defineVarsForParticles(ddf, {"piH", "piL"},
       {"mcPT",       "mcP",        "mcTheta",       "mcPhi"},
       {"pt",         "p",          "theta",         "phi"},
       {"ptResidual", "pResidual",  "thetaResidual", "phiResidual"});
   }
 
-  return ddf.Define("massDiffPreFit", "Dst_M_preFit-D0_M_preFit")
-            .Define("massDiff", "Dst_M-D0_M");
+  ddf = CachedDefine(ddf, "massDiffPreFit", "Dst_M_preFit-D0_M_preFit");
+  ddf = CachedDefine(ddf, "massDiff", "Dst_M-D0_M");
+
+  // Offline cuts, evaluated once per candidate (bit i = i-th cut passed)
+  return CachedDefine(ddf, "offlineCutsMask", CutMaskExpression(GetOfflineCuts(IsK3pi<Ch>)));
   
 }
 
 /** Define expression variables for MC. */
-SigBkgPlotter::DefineDF defineMCVariables(RDataFrame& df, bool isK3pi)
+template <class Ch>
+SigBkgPlotter::DefineDF defineMCVariables(SigBkgPlotter::DefineDF df)
 {
-  auto ddf = df.Define("testColumn","2+3");
+  auto ddf = CachedDefine(df, "testColumn", "2+3");
 
   // Define variables for piH and piL, which are pi1 and pi2 sorted by pT
-  if (isK3pi) {
+  if constexpr (Ch::Sorted) {
     for (const auto& sCol : df.GetColumnNames()) {
       TString col = sCol;
       if (!col.BeginsWith("pi1_")) continue;
@@ -130,11 +190,11 @@ SigBkgPlotter::DefineDF defineMCVariables(RDataFrame& df, bool isK3pi)
       newName.Form("piH_%s", col.Data());
       newExpr.Form("pi1_mcPT < pi2_mcPT ? pi2_%s : pi1_%s", col.Data(), col.Data());
       // cout << newName << " = " << newExpr << endl;
-      ddf = ddf.Define(newName.Data(), newExpr.Data());
+      ddf = CachedDefine(ddf, newName, newExpr);
       newName.Form("piL_%s", col.Data());
       newExpr.Form("pi1_mcPT < pi2_mcPT ? pi1_%s : pi2_%s", col.Data(), col.Data());
       // cout << newName << " = " << newExpr << endl;
-      ddf = ddf.Define(newName.Data(), newExpr.Data());
+      ddf = CachedDefine(ddf, newName, newExpr);
     }
   }
 
@@ -143,20 +203,39 @@ SigBkgPlotter::DefineDF defineMCVariables(RDataFrame& df, bool isK3pi)
 }
 
 
+/** Keeps a fraction of the events, with all their candidates, chosen by a
+ * hash of exp/run/event in [low, up): the same events are kept in all the
+ * trees, so the efficiencies are not biased, and the slices of [0, 1) are
+ * disjoint.
+ */
+SigBkgPlotter::DefineDF sampleEvents(SigBkgPlotter::DefineDF df, double low, double up)
+{
+  if (low <= 0 && up >= 1) return df;
+  return df.Filter([low, up](Int_t exp, Int_t run, Int_t evt) {
+    const double x = EventSampleValue(exp, run, evt);
+    return x >= low && x < up;
+  }, {"__experiment__", "__run__", "__event__"}, "Event sample");
+}
+
 SigBkgPlotter::FilterDF applyOfflineCuts(SigBkgPlotter::DefineDF& df, bool isK3pi)
 {
-  TString cuts = CommonCuts + " && " + (isK3pi ? K3piCuts : KpiCuts);
-  return df.Filter(cuts.Data(), "Offline Cuts");
+  TString cuts = TString::Format("offlineCutsMask == %uu", CutMaskAll(GetOfflineCuts(isK3pi)));
+  return CachedFilter(df, cuts, "Offline Cuts");
 }
 
-/** Books plots. */
-void bookHistos(SigBkgPlotter& plt, bool isK3pi)
+/** Books plots of the channel Ch.
+ * @param adaptiveBins Also books the resolution profiles with fine binning
+ * @param autoRange The ranges of the 1D histograms are decided in the loop
+ */
+template <class Ch>
+void bookHistos(SigBkgPlotter& plt, bool adaptiveBins = false, bool autoRange = false)
 {
-  const auto& CompParts = CompositeParticles;
-  const auto& FSParts = isK3pi ? K3PiFSParticlesSorted : KPiFSParticles;
-  const auto& FSHParts = isK3pi ? K3PiFSHParticlesSorted : KPiFSHParticles;
-  // const auto& AllParts = isK3pi ? K3PiAllParticlesSorted : KPiAllParticles;
-  // const auto& Pions = isK3pi ? K3PiPionsSorted : KPiPions;
+  plt.SetAutoRange(autoRange);
+  const auto& CompParts = Ch::Composites::Names();
+  const auto& FSParts = Ch::FSSorted::Names();
+  const auto& FSHParts = Ch::FSHSorted::Names();
+  // const auto& AllParts = Ch::AllSorted::Names();
+  // const auto& Pions = Ch::PionsSorted::Names();
 
   // ==== Masses (and cuts variables)
   // Pre-fit
@@ -225,6 +304,14 @@ void bookHistos(SigBkgPlotter& plt, bool isK3pi)
   // fit parameters : 2D
   plt.Histo2D(FSHParts,   "mcPT",    "ptResidual",    "p_{T,$p} residual;p_{T,$p} [GeV/c];MC - meas", 25, 0., 2.5, 100, -0.02, 0.02);
   plt.Histo2D({"pisoft"}, "mcPT",    "ptResidual",    "p_{T,$p} residual;p_{T,$p} [GeV/c];MC - meas", 25, 0., 0.25, 100, -0.02, 0.02);
+  if (adaptiveBins) { // Signal only, merged into equal-population bins by DoPlot
+    plt.Histo2D(FSHParts,   "mcPT", "d0Residual", "d_{0,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 2.5,  300, -0.06, 0.06, true);
+    plt.Histo2D({"pisoft"}, "mcPT", "d0Residual", "d_{0,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 0.25, 500, -1., 1., true);
+    plt.Histo2D(FSHParts,   "mcPT", "z0Residual", "z_{0,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 2.5,  300, -0.06, 0.06, true);
+    plt.Histo2D({"pisoft"}, "mcPT", "z0Residual", "z_{0,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 0.25, 500, -1., 1., true);
+    plt.Histo2D(FSHParts,   "mcPT", "ptResidual", "p_{T,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 2.5, 100, -0.02, 0.02, true);
+    plt.Histo2D({"pisoft"}, "mcPT", "ptResidual", "p_{T,$p} residual;p_{T,$p} [GeV/c];MC - meas", ProfileFineBins, 0., 0.25, 100, -0.02, 0.02, true);
+  }
   plt.Histo2D(FSHParts,   "mcP",     "pResidual",     "p_{$p} residual;p_{$p} [GeV/c];MC - meas",   25, 0., 2.5, 100, -0.02, 0.02);
   plt.Histo2D({"pisoft"}, "mcP",     "pResidual",     "p_{$p} residual;p_{$p} [GeV/c];MC - meas",   25, 0., 0.25, 100, -0.02, 0.02);
   plt.Histo2D(FSHParts,   "mcTheta", "thetaResidual", "theta_{$p} residual;theta_{$p};MC - meas", 25, 0., TMath::Pi(), 100, -0.0025, 0.0025);
@@ -257,7 +344,7 @@ void bookHistos(SigBkgPlotter& plt, bool isK3pi)
   plt.EffH1D({"B0"}, "mcTheta", "Efficiency vs true #theta_{$p};True #theta_{$p} [#circ]", 20, 0, 25, 180 / M_PI);
   plt.EffH1D({"Dst", "D0"}, "mcTheta", "Efficiency vs true #theta_{$p};True #theta_{$p} [#circ]", 20, 0, 180, 180 / M_PI);
   plt.EffH1D(CompParts, "mcPhi", "Efficiency vs true #phi_{$p};True #phi_{$p} [#circ]", 20, -180, 180, 180 / M_PI);
-  if (!isK3pi)
+  if constexpr (std::is_same_v<Ch, KpiChannel>)
     plt.EffH1D("Kpi_MCAngle", "Eff. vs true K-to-#pi angle;True angle between K and #pi [#circ]", 20, 40, 180, 180 / M_PI);
 
   // ==== Efficiency
@@ -267,15 +354,52 @@ void bookHistos(SigBkgPlotter& plt, bool isK3pi)
   
 }
 
-void DoPlot(SigBkgPlotter& plt, bool isK3pi)
+/** Schedules the fits of the masses, residuals and pulls. */
+template <class Ch>
+void scheduleFits(SigBkgPlotter& plt, FitScheduler& fits)
+{
+  const auto& CompParts = Ch::Composites::Names();
+  const auto& FSParts = Ch::FSSorted::Names();
+
+  // ==== Masses
+  plt.ScheduleFit(fits, "B0_M", SingleGaussian);
+  plt.ScheduleFit(fits, "Dst_M", DoubleGaussian);
+  plt.ScheduleFit(fits, "D0_M", DoubleGaussian);
+  plt.ScheduleFit(fits, "massDiff", DoubleGaussian);
+
+  // ==== Residuals and pulls (fine binning)
+  for (const TString& part : CompParts) {
+    for (const TString v : {"X", "Y", "Z"}) {
+      plt.ScheduleFit(fits, part + "_residualDecay" + v + "_2", DoubleGaussian);
+      plt.ScheduleFit(fits, part + "_pullDecay" + v, SingleGaussian);
+    }
+  }
+  plt.ScheduleFit(fits, "D0_residualFlightDistance_2", DoubleGaussian);
+  plt.ScheduleFit(fits, "D0_pullFlightDistance", SingleGaussian);
+  for (const TString& part : FSParts) {
+    plt.ScheduleFit(fits, part + "_d0Residual_2", DoubleGaussian);
+    plt.ScheduleFit(fits, part + "_z0Residual_2", DoubleGaussian);
+    plt.ScheduleFit(fits, part + "_d0Pull_2", SingleGaussian);
+    plt.ScheduleFit(fits, part + "_z0Pull_2", SingleGaussian);
+  }
+}
+
+/** Prints all the plots of plt.
+ * @param adaptiveBins The plots were booked with adaptiveBins
+ */
+template <class Ch>
+void DoPlot(SigBkgPlotter& plt, const FitScheduler& fits, bool adaptiveBins = false)
 {
-  const auto& CompParts = CompositeParticles;
-  const auto& FSParts = isK3pi ? K3PiFSParticlesSorted : KPiFSParticles;
-  // const auto& Pions = isK3pi ? K3PiPionsSorted : KPiPions;
+  const auto& CompParts = Ch::Composites::Names();
+  const auto& FSParts = Ch::FSSorted::Names();
+  // const auto& Pions = Ch::PionsSorted::Names();
 
   // ==== Histograms
   plt.PrintAll(true);
 
+  // ==== Fits (already run, see scheduleFits)
+  plt.PrintFits(fits);
+
   // ==== sigma68
   // Vertices
   for (const TString& part : CompParts) {
@@ -298,6 +422,26 @@ void DoPlot(SigBkgPlotter& plt, bool isK3pi)
     plt.SigmaAndWrite(part + "_mcPT_" + part + "_z0Residual", "[#mum]", 68, 1.e4, false);
     plt.SigmaAndWrite(part + "_mcPT_" + part + "_ptResidual", "[#times10^{3}]", 68, 1.e3, true);
   }
+  if (adaptiveBins) {
+    for (const TString &part : FSParts) {
+      plt.SigmaAndWrite(part + "_mcPT_" + part + "_d0Residual_2", "[#mum]", 68, 1.e4, false, ProfileQuantileBins);
+      plt.SigmaAndWrite(part + "_mcPT_" + part + "_z0Residual_2", "[#mum]", 68, 1.e4, false, ProfileQuantileBins);
+      plt.SigmaAndWrite(part + "_mcPT_" + part + "_ptResidual_2", "[#times10^{3}]", 68, 1.e3, true, ProfileQuantileBins);
+    }
+  }
+}
+
+/** Returns the worst relative precision of the sigma68 profiles printed by
+ * DoPlot for plt (see SigBkgPlotter::GetSigmaPrecision).
+ */
+template <class Ch>
+double sigmaPrecision(SigBkgPlotter& plt)
+{
+  double worst = 0;
+  for (const TString& part : Ch::FSSorted::Names())
+    for (const TString v : {"d0Residual", "z0Residual", "ptResidual"})
+      worst = max(worst, plt.GetSigmaPrecision(part + "_mcPT_" + part + "_" + v));
+  return worst;
 }
 
 void DoCandAna(tuple<TH2D*,UInt_t,UInt_t> noCuts, tuple<TH2D*,UInt_t,UInt_t> cuts,
@@ -338,99 +482,963 @@ void DoCandAna(tuple<TH2D*,UInt_t,UInt_t> noCuts, tuple<TH2D*,UInt_t,UInt_t> cut
   cout << fs << endl;
 }
 
-int main(int argc, char* argv[])
+/** Prints how the best candidate selection strategies compare, given the
+ * number of signal candidates after the offline cuts.
+ */
+void DoBCComparison(const vector<RankingStrategy>& strategies,
+                    const vector<tuple<UInt_t,UInt_t>>& bcs, UInt_t nsc, UInt_t nMC)
 {
-  ArgParser parser("Analysis program for B0 -> [D* -> [D0 -> K pi (pi pi)] pi] mu nu.");
-  parser.AddPositionalArg("inputRootFile");
-  auto args = parser.ParseArgs(argc, argv);
+  TString fs;
+  cout << "   Best cand. strategy   |  Signal  |Background| b.c. eff.|Efficiency|  Purity" << endl;
+  cout << "   ----------------------+----------+----------+----------+----------+----------" << endl;
+  for (size_t i = 0; i < strategies.size(); i++) {
+    const double nsb = get<0>(bcs[i]), nbb = get<1>(bcs[i]);
+    fs.Form("   %-22s|%10.0f|%10.0f|%9.4g%%|%9.4g%%|%9.4g%%", strategies[i].name.Data(),
+            nsb, nbb, 100.0 * nsb / nsc, 100.0 * nsb / nMC, 100.0 * nsb / (nsb + nbb));
+    cout << fs << endl;
+  }
+}
 
-  EnableImplicitMT(NThreads);
+/** Writes the efficiency, purity and S/sqrt(S+B) of every combination of
+ * thresholds of a cut scan to the current directory, and prints the best
+ * combinations.
+ */
+void DoCutScan(tuple<THnD*,THnD*> scan, const vector<CutScanAxis>& axes,
+               UInt_t nMC, TString title, int nPrint = 10)
+{
+  THnD* hSig = get<0>(scan);
+  THnD* hBkg = get<1>(scan);
+  TString name = hSig->GetName();
+  name.ReplaceAll("_sig", "");
+  auto hEff = (THnD*)hSig->Clone(name + "_eff");
+  auto hPurity = (THnD*)hSig->Clone(name + "_purity");
+  auto hSignif = (THnD*)hSig->Clone(name + "_significance");
+  hEff->SetTitle(title + " - Efficiency");
+  hPurity->SetTitle(title + " - Purity");
+  hSignif->SetTitle(title + " - S/#sqrt{S+B}");
 
-  TString inFileName = args["inputRootFile"];
-  if (!inFileName.EndsWith(".root")) {
-    cout << "Invalid input file (expected to end with \".root\")." << endl;
-    return 1;
+  const int dim = axes.size();
+  vector<int> idx(dim);
+  vector<pair<double,Long64_t>> ranking;
+  for (Long64_t c = 0; c < hSig->GetNbins(); c++) {
+    const double ns = hSig->GetBinContent(c, idx.data()), nb = hBkg->GetBinContent(c);
+    bool isFlow = false;
+    for (int i = 0; i < dim; i++)
+      isFlow |= idx[i] < 1 || idx[i] > axes[i].nThresholds;
+    if (isFlow) continue;
+    hEff->SetBinContent(c, nMC == 0 ? 0.0 : ns / nMC);
+    hPurity->SetBinContent(c, ns + nb == 0 ? 0.0 : ns / (ns + nb));
+    hSignif->SetBinContent(c, ns + nb == 0 ? 0.0 : ns / TMath::Sqrt(ns + nb));
+    ranking.emplace_back(hSignif->GetBinContent(c), c);
   }
-  TString outFileName = inFileName(0, inFileName.Length() - 5);
-  TString outFileNameCuts = inFileName(0, inFileName.Length() - 5) + "_offline_cuts";
-  TString outFileNameBC = inFileName(0, inFileName.Length() - 5) + "_best_candidate";
+  for (THnD* h : {hSig, hBkg, hEff, hPurity, hSignif})
+    WriteResult(h);
 
-  RDataFrame dfKpi("Kpi", inFileName.Data());
-  RDataFrame dfK3pi("K3pi", inFileName.Data());
-  RDataFrame dfMCKpi("MCKpi", inFileName.Data());
-  RDataFrame dfMCK3pi("MCK3pi", inFileName.Data());
+  sort(ranking.begin(), ranking.end(), greater<pair<double,Long64_t>>());
+  cout << title << " cut scan (" << ranking.size() << " combinations), best by S/sqrt(S+B):" << endl;
+  for (int r = 0; r < nPrint && r < (int)ranking.size(); r++) {
+    const Long64_t c = ranking[r].second;
+    hSig->GetBinContent(c, idx.data());
+    TString fs;
+    for (int i = 0; i < dim; i++)
+      fs += TString::Format("%s %s %.4g ", axes[i].name.Data(), axes[i].keepLow ? "<" : ">",
+                            hSig->GetAxis(i)->GetBinCenter(idx[i]));
+    fs += TString::Format("| S/sqrt(S+B) = %.4g, eff. = %.4g%%, purity = %.4g%%", ranking[r].first,
+                          100.0 * hEff->GetBinContent(c), 100.0 * hPurity->GetBinContent(c));
+    cout << "   " << fs << endl;
+  }
+}
 
-  auto dfDefKpi = defineVariables(dfKpi, false);
-  auto dfDefK3pi = defineVariables(dfK3pi, true);
-  auto dfCutKpi = applyOfflineCuts(dfDefKpi, false);
-  auto dfCutK3pi = applyOfflineCuts(dfDefK3pi, true);
-  auto dfBCKpi = dfCutKpi.Filter("B0_M_rank == 1", "Best Candidate");
-  auto dfBCK3pi = dfCutK3pi.Filter("B0_M_rank == 1", "Best Candidate");
+/** Books a best candidate plotter of the channel Ch for each strategy of
+ * ranker, on dfRanked (with the rank columns, see RankCandidates).
+ */
+template <class Ch>
+vector<unique_ptr<SigBkgPlotter>> BookBestCandidates(
+  SigBkgPlotter::FilterDF& dfRanked, SigBkgPlotter::DefineDF& mcdf, CandidateRanker& ranker,
+  PDFCanvas& c, TString namePrefix, TString titlePrefix, bool autoRange = false)
+{
+  vector<unique_ptr<SigBkgPlotter>> res;
+  for (const auto& s : ranker.GetStrategies()) {
+    auto dfBC = CachedFilter(dfRanked, s.name + "_rank == 1", "Best Candidate (" + s.title + ")");
+    res.push_back(make_unique<SigBkgPlotter>(dfBC, mcdf, SignalCondition, c, namePrefix + s.name,
+                                             titlePrefix + " (" + s.title + ")"));
+    bookHistos<Ch>(*res.back(), false, autoRange);
+  }
+  return res;
+}
 
-  auto dfDefMCKpi = defineMCVariables(dfMCKpi, false);
-  auto dfDefMCK3pi = defineMCVariables(dfMCK3pi, true);
+/** Books the resolution maps of the channel Ch (TrackResolutionMaps for each
+ * hard final state track, VertexResolutionMaps for the D0) on df.
+ */
+template <class Ch>
+void bookResolutionMaps(SigBkgPlotter::FilterDF df, vector<unique_ptr<ResolutionMapAccumulator>>& accus,
+                        vector<ROOT::RDF::RResultPtr<ULong64_t>>& loops, TString namePrefix)
+{
+  auto book = [&](const ResolutionMapDef& def, const TString& p) {
+    vector<ResolutionMapAxis> axes = def.axes;
+    for (auto& a : axes) {
+      a.name.ReplaceAll("$p", ParticlesTitles.at(p));
+      a.expression.ReplaceAll("$p", p);
+    }
+    accus.push_back(make_unique<ResolutionMapAccumulator>(axes, namePrefix + "_" + p + "_" + def.name + "Map",
+                                                          df.GetNSlots()));
+    loops.push_back(BookResolutionMap(df, *accus.back()));
+  };
+  for (const auto& def : TrackResolutionMaps)
+    for (const TString& p : Ch::FSHSorted::Names())
+      book(def, p);
+  for (const auto& def : VertexResolutionMaps)
+    book(def, "D0");
+}
 
-  gStyle->SetOptStat(0); // TODO If more style lines appear, make a function
-  PDFCanvas canvas(outFileName + ".pdf", "c"); // Default size is fine (I wrote it!)
-  PDFCanvas canvasCuts(outFileNameCuts + ".pdf", "cc");
-  PDFCanvas canvasBC(outFileNameBC + ".pdf", "ccb");
-  PDFCanvas canvasCand(outFileName + "_candidates.pdf", "ccc");
+/** Features of the channel Ch exported by --export: ExportEventVariables,
+ * the ranks and ExportParticleVariables for each final state particle.
+ */
+template <class Ch>
+vector<TString> exportFeatures()
+{
+  vector<TString> res(ExportEventVariables.begin(), ExportEventVariables.end());
+  for (const auto& s : BCStrategies)
+    res.push_back(s.name + "_rank");
+  for (const TString& p : Ch::FSSorted::Names())
+    for (const auto& v : ExportParticleVariables)
+      res.push_back(p + "_" + v);
+  return res;
+}
+
+/** Optional parts of the analysis, from the command line. */
+struct AnalysisOptions {
+  bool cutScan = false; /**< Scan the offline cuts (CutScanAxes). */
+  bool adaptiveBins = false; /**< Equal-population resolution profiles (main plotters only). */
+  bool truthJoin = false; /**< Per-true-B analysis, joining the candidates with the MC B. */
+  bool variations = false; /**< Plotters for all the selection Variations. */
+  ULong64_t memBudget = 0; /**< Bytes, 0 for no budget (see BookAnalysis). */
+  size_t purityReserve = PurityReserve; /**< See SigBkgPlotter::SetPurityReserve. */
+  double fractionLow = 0, fraction = 1; /**< Slice of the events to process (see sampleEvents). */
+  bool ioStats = false; /**< Time spent waiting on the input, per slot (IOMonitor). */
+  bool concurrentLoops = false; /**< Run the loops of the four trees together (see Run). */
+  bool resolutionMaps = false; /**< Sparse N-dim resolution maps of the signal (ResolutionMapAccumulator). */
+  TString exportDir; /**< Export the candidates after the cuts to .npy files here, "" for none. */
+  bool cutOrder = false; /**< Measure the cheapest order of the offline cuts (CutOrderStats). */
+  bool autoRange = false; /**< Ranges of the 1D histograms decided in the loops (AutoRange). */
+};
+
+/** The options that change what Analysis::Save writes, as a key of the
+ * ResultsStore: partial results made with other options cannot be merged.
+ */
+TString ResultsKey(const AnalysisOptions& opts)
+{
+  return TString::Format("cutScan=%d adaptiveBins=%d truthJoin=%d variations=%d resolutionMaps=%d",
+                         opts.cutScan, opts.adaptiveBins, opts.truthJoin, opts.variations, opts.resolutionMaps);
+}
+
+/** The dataframes, the plotters and the candidate analyses booked on a
+ * list of input files.
+ */
+struct Analysis {
+  Analysis(const vector<string>& files, PDFCanvas& canvas, PDFCanvas& canvasCuts, PDFCanvas& canvasBC,
+           AnalysisOptions opts = AnalysisOptions());
+  ~Analysis();
+
+  /** Runs the event loops (the plotters' histograms are filled too). With
+   * opts.concurrentLoops, all the analyses are booked first and the loops of
+   * the four trees run together on the thread pool, in two rounds (the best
+   * candidate plotters depend on the ranking): each tree is read once per
+   * round instead of once per candidate analysis.
+   */
+  void Run();
+
+  /** The concurrent loops of Run. */
+  void RunConcurrent();
+
+  /** Books the export of the candidates after the cuts, with their ranks. */
+  void BookExports(SigBkgPlotter::FilterDF& dfRankedKpi, SigBkgPlotter::FilterDF& dfRankedK3pi);
+
+  /** Writes the partial results to dir (after Run). */
+  void Save(TDirectory* dir);
+
+  /** Adds the partial results found in dir to the current ones (after Run). */
+  void Merge(TDirectory* dir);
+
+  /** Prints the candidates analysis to canvasCand, then all the plots,
+   * saving the efficiencies to outRootFile (after Run).
+   */
+  void Print(PDFCanvas& canvasCand, TFile& outRootFile);
+
+  /** All the plotters (the best candidate ones only exist after Run). */
+  vector<SigBkgPlotter*> GetPlotters();
+
+  /** Estimated memory of each plotter and of the cut scan (before Run, the
+   * best candidate plotters are estimated from the cuts ones).
+   */
+  vector<pair<TString,Footprint>> GetFootprints();
+
+  /** Prints and returns the worst relative statistical precision of the
+   * efficiency and of the sigma68 values of the reference best candidate
+   * plotters (after Run), which goes like 1/sqrt(opts.fraction).
+   */
+  double GetPrecision();
+
+  AnalysisOptions opts;
+  vector<string> files;
+  RDataFrame dfKpi, dfK3pi, dfMCKpi, dfMCK3pi;
+  SigBkgPlotter::DefineDF dfDefKpi, dfDefK3pi;
+  SigBkgPlotter::FilterDF dfCutKpi, dfCutK3pi;
+  SigBkgPlotter::DefineDF dfDefMCKpi, dfDefMCK3pi;
+  PDFCanvas& canvasBC;
+
+  SigBkgPlotter plotterKpi, plotterK3pi, plotterKpiCuts, plotterK3piCuts;
+  CandidateRanker rankerKpi, rankerK3pi;
+  vector<unique_ptr<SigBkgPlotter>> plottersKpiBC, plottersK3piBC; /**< One per BCStrategies. */
+  CutFlow cutFlowKpi, cutFlowK3pi;
+  unique_ptr<VariationSet> variationsKpi, variationsK3pi; /**< If opts.variations. */
+
+  tuple<TH2D*,UInt_t,UInt_t> hCandKpi, hCandKpiCuts;
+  tuple<TH2D*,UInt_t,UInt_t> hCandK3pi, hCandK3piCuts;
+  vector<tuple<UInt_t,UInt_t>> bcKpi, bcK3pi; /**< {sig,bkg} best candidates, one per BCStrategies. */
+  tuple<THnD*,THnD*> scanKpi, scanK3pi; /**< {sig,bkg} cut scans (if opts.cutScan). */
+  TruthJoinHistos joinKpi {}, joinK3pi {}; /**< Per-true-B histograms (if opts.truthJoin). */
+  vector<unique_ptr<IOMonitor>> ioMonitors; /**< One per tree (if opts.ioStats). */
+  vector<unique_ptr<ResolutionMapAccumulator>> resMapAccus; /**< If opts.resolutionMaps. */
+  vector<THnSparseD*> resMaps; /**< The maps of resMapAccus (after Run). */
+  unique_ptr<NpyExporter> exportKpi, exportK3pi; /**< If opts.exportDir is set. */
+  unique_ptr<CutOrderStats> cutOrderKpi, cutOrderK3pi; /**< If opts.cutOrder. */
+  vector<ROOT::RDF::RResultPtr<ULong64_t>> sideLoops; /**< Keep the analyses above booked. */
+  ULong64_t nMCKpi = 0, nMCK3pi = 0;
+};
+
+Analysis::Analysis(const vector<string>& files, PDFCanvas& canvas, PDFCanvas& canvasCuts, PDFCanvas& canvasBC,
+                   AnalysisOptions opts)
+: opts(opts), files(files), dfKpi("Kpi", files), dfK3pi("K3pi", files), dfMCKpi("MCKpi", files), dfMCK3pi("MCK3pi", files),
+  dfDefKpi(defineVariables<KpiChannel>(sampleEvents(dfKpi, opts.fractionLow, opts.fraction))),
+  dfDefK3pi(defineVariables<K3piChannel>(sampleEvents(dfK3pi, opts.fractionLow, opts.fraction))),
+  dfCutKpi(applyOfflineCuts(dfDefKpi, false)), dfCutK3pi(applyOfflineCuts(dfDefK3pi, true)),
+  dfDefMCKpi(defineMCVariables<KpiChannel>(sampleEvents(dfMCKpi, opts.fractionLow, opts.fraction))),
+  dfDefMCK3pi(defineMCVariables<K3piChannel>(sampleEvents(dfMCK3pi, opts.fractionLow, opts.fraction))),
+  canvasBC(canvasBC),
+  plotterKpi(dfDefKpi, dfDefMCKpi, SignalCondition, canvas, "Kpi", "K#pi"),
+  plotterK3pi(dfDefK3pi, dfDefMCK3pi, SignalCondition, canvas, "K3pi", "K3#pi"),
+  plotterKpiCuts(dfCutKpi, dfDefMCKpi, SignalCondition, canvasCuts, "KpiCuts", "K#pi"),
+  plotterK3piCuts(dfCutK3pi, dfDefMCK3pi, SignalCondition, canvasCuts, "K3piCuts", "K3#pi"),
+  rankerKpi(BCStrategies), rankerK3pi(BCStrategies),
+  cutFlowKpi(dfDefKpi, dfDefMCKpi, GetOfflineCuts(false), SignalCondition, canvasCuts, "Kpi", "K#pi"),
+  cutFlowK3pi(dfDefK3pi, dfDefMCK3pi, GetOfflineCuts(true), SignalCondition, canvasCuts, "K3pi", "K3#pi")
+{
+  bookHistos<KpiChannel>(plotterKpi, opts.adaptiveBins, opts.autoRange);
+  bookHistos<K3piChannel>(plotterK3pi, opts.adaptiveBins, opts.autoRange);
+  bookHistos<KpiChannel>(plotterKpiCuts, opts.adaptiveBins, opts.autoRange);
+  bookHistos<K3piChannel>(plotterK3piCuts, opts.adaptiveBins, opts.autoRange);
+  if (opts.variations) {
+    variationsKpi = make_unique<VariationSet>(dfDefKpi, dfDefMCKpi, Variations, GetOfflineCuts(false),
+                                              canvasCuts, "Kpi", "K#pi");
+    variationsK3pi = make_unique<VariationSet>(dfDefK3pi, dfDefMCK3pi, Variations, GetOfflineCuts(true),
+                                               canvasCuts, "K3pi", "K3#pi");
+    for (auto plt : variationsKpi->GetPlotters())
+      bookHistos<KpiChannel>(*plt, false, opts.autoRange);
+    for (auto plt : variationsK3pi->GetPlotters())
+      bookHistos<K3piChannel>(*plt, false, opts.autoRange);
+  }
+  for (auto plt : GetPlotters())
+    plt->SetPurityReserve(opts.purityReserve);
+  if (opts.resolutionMaps) {
+    bookResolutionMaps<KpiChannel>(CachedFilter(dfCutKpi, SignalCondition, "Signal"), resMapAccus, sideLoops,
+                                   "KpiCuts");
+    bookResolutionMaps<K3piChannel>(CachedFilter(dfCutK3pi, SignalCondition, "Signal"), resMapAccus, sideLoops,
+                                    "K3piCuts");
+  }
+  if (opts.cutOrder) {
+    cutOrderKpi = make_unique<CutOrderStats>(GetOfflineCuts(false), dfDefKpi.GetColumnNames());
+    cutOrderK3pi = make_unique<CutOrderStats>(GetOfflineCuts(true), dfDefK3pi.GetColumnNames());
+    sideLoops.push_back(BookCutOrderStats(dfDefKpi, *cutOrderKpi));
+    sideLoops.push_back(BookCutOrderStats(dfDefK3pi, *cutOrderK3pi));
+  }
+  if (opts.ioStats) {
+    ioMonitors.push_back(make_unique<IOMonitor>(dfKpi, "Kpi"));
+    ioMonitors.push_back(make_unique<IOMonitor>(dfK3pi, "K3pi"));
+    ioMonitors.push_back(make_unique<IOMonitor>(dfMCKpi, "MCKpi"));
+    ioMonitors.push_back(make_unique<IOMonitor>(dfMCK3pi, "MCK3pi"));
+  }
+}
+
+Analysis::~Analysis()
+{
+  for (auto h : {get<0>(hCandKpi), get<0>(hCandKpiCuts), get<0>(hCandK3pi), get<0>(hCandK3piCuts)})
+    delete h;
+  for (auto h : {get<0>(scanKpi), get<1>(scanKpi), get<0>(scanK3pi), get<1>(scanK3pi)})
+    delete h;
+  for (auto join : {&joinKpi, &joinK3pi})
+    for (TH1D* h : join->All())
+      delete h;
+  for (auto h : resMaps)
+    delete h;
+}
+
+vector<SigBkgPlotter*> Analysis::GetPlotters()
+{
+  vector<SigBkgPlotter*> res {&plotterKpi, &plotterK3pi, &plotterKpiCuts, &plotterK3piCuts};
+  for (const auto& plt : plottersKpiBC) res.push_back(plt.get());
+  for (const auto& plt : plottersK3piBC) res.push_back(plt.get());
+  if (opts.variations)
+    for (auto vs : {variationsKpi.get(), variationsK3pi.get()})
+      for (auto plt : vs->GetPlotters())
+        res.push_back(plt);
+  return res;
+}
+
+/** Number of entries of tree in files (only the headers are read). */
+ULong64_t TreeEntries(const vector<string>& files, const char* tree)
+{
+  TChain chain(tree);
+  for (const auto& file : files)
+    chain.Add(file.c_str());
+  return chain.GetEntries();
+}
 
-  SigBkgPlotter plotterKpi(dfDefKpi, dfDefMCKpi, SignalCondition, canvas, "Kpi", "K#pi");
-  SigBkgPlotter plotterK3pi(dfDefK3pi, dfDefMCK3pi, SignalCondition, canvas, "K3pi", "K3#pi");
-  SigBkgPlotter plotterKpiCuts(dfCutKpi, dfDefMCKpi, SignalCondition, canvasCuts, "KpiCuts", "K#pi");
-  SigBkgPlotter plotterK3piCuts(dfCutK3pi, dfDefMCK3pi, SignalCondition, canvasCuts, "K3piCuts", "K3#pi");
-  SigBkgPlotter plotterKpiBC(dfBCKpi, dfDefMCKpi, SignalCondition, canvasBC, "KpiBC", "K#pi");
-  SigBkgPlotter plotterK3piBC(dfBCK3pi, dfDefMCK3pi, SignalCondition, canvasBC, "K3piBC", "K3#pi");
+vector<pair<TString,Footprint>> Analysis::GetFootprints()
+{
+  // The candidates of the loops, for the event lists (all the plotter names
+  // start with the channel)
+  const ULong64_t nKpi = (opts.fraction - opts.fractionLow) * TreeEntries(files, "Kpi");
+  const ULong64_t nK3pi = (opts.fraction - opts.fractionLow) * TreeEntries(files, "K3pi");
+  vector<pair<TString,Footprint>> res;
+  for (auto plt : GetPlotters()) {
+    const bool isK3pi = plt->GetNamePrefix().BeginsWith("K3pi");
+    res.emplace_back(plt->GetNamePrefix(), plt->GetFootprint(isK3pi ? nK3pi : nKpi));
+  }
+  if (plottersKpiBC.empty()) {
+    for (const auto& s : BCStrategies) {
+      res.emplace_back("Kpi" + s.name, plotterKpiCuts.GetFootprint(nKpi));
+      res.emplace_back("K3pi" + s.name, plotterK3piCuts.GetFootprint(nK3pi));
+    }
+  }
+  if (opts.cutScan) {
+    for (bool isK3pi : {false, true}) {
+      Long64_t nCells = 1, nBins = 1;
+      for (const auto& a : isK3pi ? K3piCutScanAxes : KpiCutScanAxes) {
+        nCells *= a.nThresholds;
+        nBins *= a.nThresholds + 2;
+      }
+      Footprint fp; // {sig,bkg} counts per slot, then {sig,bkg} THnD
+      fp.perSlot = 2 * nCells * sizeof(double);
+      fp.fixed = 2 * nBins * sizeof(double);
+      res.emplace_back(isK3pi ? "K3piCutScan" : "KpiCutScan", fp);
+    }
+  }
+  return res;
+}
 
-  bookHistos(plotterKpi, false);
-  bookHistos(plotterK3pi, true);
-  bookHistos(plotterKpiCuts, false);
-  bookHistos(plotterK3piCuts, true);
-  bookHistos(plotterKpiBC, false);
-  bookHistos(plotterK3piBC, true);
+double Analysis::GetPrecision()
+{
+  double worst = 0;
+  for (bool isK3pi : {false, true}) {
+    // Signal after the reference best candidate selection, and MC events
+    const double nSig = get<0>((isK3pi ? bcK3pi : bcKpi).front());
+    const double nMC = isK3pi ? nMCK3pi : nMCKpi;
+    // Binomial efficiency, and the sigma68 of each bin of the profiles
+    const double effPrecision = nSig > 0 && nMC >= nSig ? TMath::Sqrt((1 - nSig / nMC) / nSig) : 1;
+    const double sigmaPrec = isK3pi ? sigmaPrecision<K3piChannel>(*plottersK3piBC.front())
+                                    : sigmaPrecision<KpiChannel>(*plottersKpiBC.front());
+    cout << TString::Format("%s precision: efficiency %.2g%% (%.0f signal candidates), sigma68 %.2g%% (worst bin)",
+                            isK3pi ? "K3pi" : "Kpi", 100 * effPrecision, nSig, 100 * sigmaPrec) << endl;
+    worst = max({worst, effPrecision, sigmaPrec});
+  }
+  return worst;
+}
+
+void Analysis::Run()
+{
+  RSSMonitor monitor(opts.memBudget);
+  const auto start = chrono::steady_clock::now();
+  const Long64_t bytesRead = TFile::GetFileBytesRead();
+  auto nMCKpiRes = dfMCKpi.Count();
+  auto nMCK3piRes = dfMCK3pi.Count();
+  if (opts.concurrentLoops) {
+    RunConcurrent();
+  } else {
+    // The ranking loops also fill the histograms booked up to now
+    auto dfRankedKpi = RankCandidates(dfCutKpi, rankerKpi);
+    auto dfRankedK3pi = RankCandidates(dfCutK3pi, rankerK3pi);
+    plottersKpiBC = BookBestCandidates<KpiChannel>(dfRankedKpi, dfDefMCKpi, rankerKpi, canvasBC, "Kpi", "K#pi",
+                                                   opts.autoRange);
+    plottersK3piBC = BookBestCandidates<K3piChannel>(dfRankedK3pi, dfDefMCK3pi, rankerK3pi, canvasBC,
+                                                     "K3pi", "K3#pi", opts.autoRange);
+    for (auto plt : GetPlotters()) // The best candidate ones are new, their loop has not run yet
+      plt->SetPurityReserve(opts.purityReserve);
+    if (!opts.exportDir.IsNull())
+      BookExports(dfRankedKpi, dfRankedK3pi);
+    if (opts.cutScan) {
+      scanKpi = CutScanAnalysis(dfDefKpi, KpiCutScanAxes, CutScanBaseCuts(GetOfflineCuts(false), KpiCutScanAxes),
+                                "KpiCutScan");
+      scanK3pi = CutScanAnalysis(dfDefK3pi, K3piCutScanAxes,
+                                 CutScanBaseCuts(GetOfflineCuts(true), K3piCutScanAxes), "K3piCutScan");
+    }
+    hCandKpi = CutEfficiencyAnalysis(dfDefKpi);
+    hCandKpiCuts = CutEfficiencyAnalysis(dfCutKpi);
+    hCandK3pi = CutEfficiencyAnalysis(dfDefK3pi);
+    hCandK3piCuts = CutEfficiencyAnalysis(dfCutK3pi);
+  }
+  bcKpi.clear();
+  bcK3pi.clear();
+  for (size_t i = 0; i < BCStrategies.size(); i++) {
+    bcKpi.push_back(rankerKpi.GetBestCounts(i));
+    bcK3pi.push_back(rankerK3pi.GetBestCounts(i));
+  }
+  if (opts.truthJoin) {
+    joinKpi = TruthJoinAnalysis(files, false, "KpiTruthJoin");
+    joinK3pi = TruthJoinAnalysis(files, true, "K3piTruthJoin");
+  }
+  nMCKpi = *nMCKpiRes;
+  nMCK3pi = *nMCK3piRes;
+  if (opts.resolutionMaps) // Filled by the first loops
+    for (const auto& accu : resMapAccus)
+      resMaps.push_back(accu->GetResult());
+  if (opts.cutOrder) {
+    cout << "Kpi: " << cutOrderKpi->GetSummary() << endl;
+    cout << "K3pi: " << cutOrderK3pi->GetSummary() << endl;
+  }
+  if (exportKpi) {
+    for (auto [channel, e] : {make_pair("Kpi", exportKpi.get()), make_pair("K3pi", exportK3pi.get())}) {
+      const ULong64_t rows = e->Close();
+      cout << TString::Format("Exported %llu %s candidates (%zu features) to %s/%s", rows, channel,
+                              e->GetFeatures().size(), opts.exportDir.Data(), channel) << endl;
+    }
+  }
+
+  if (opts.ioStats) {
+    for (const auto& m : ioMonitors)
+      m->Print();
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    const double mb = (TFile::GetFileBytesRead() - bytesRead) / 1048576.0;
+    cout << TString::Format("Read %.0f MB in %.1f s (%.1f MB/s)", mb, elapsed.count(), mb / elapsed.count()) << endl;
+  }
+}
+
+void Analysis::RunConcurrent()
+{
+  // Round 1: the ranking, the cut efficiencies and the cut scan on the
+  // candidates, with the plotters booked up to now; the MC loops wait for
+  // round 2, which also fills the MC histograms of the best candidate plotters
+  CutEfficiencyAccumulator accuKpi, accuKpiCuts, accuK3pi, accuK3piCuts;
+  vector<ROOT::RDF::RResultHandle> round {
+    BookRanking(dfCutKpi, rankerKpi), BookRanking(dfCutK3pi, rankerK3pi),
+    BookCutEfficiency(dfDefKpi, accuKpi), BookCutEfficiency(dfCutKpi, accuKpiCuts),
+    BookCutEfficiency(dfDefK3pi, accuK3pi), BookCutEfficiency(dfCutK3pi, accuK3piCuts)};
+  unique_ptr<CutScanAccumulator> scanAccuKpi, scanAccuK3pi;
+  if (opts.cutScan) {
+    scanAccuKpi = make_unique<CutScanAccumulator>(KpiCutScanAxes);
+    scanAccuK3pi = make_unique<CutScanAccumulator>(K3piCutScanAxes);
+    round.push_back(BookCutScan(dfDefKpi, KpiCutScanAxes, CutScanBaseCuts(GetOfflineCuts(false), KpiCutScanAxes),
+                                *scanAccuKpi));
+    round.push_back(BookCutScan(dfDefK3pi, K3piCutScanAxes, CutScanBaseCuts(GetOfflineCuts(true), K3piCutScanAxes),
+                                *scanAccuK3pi));
+  }
+  ROOT::RDF::RunGraphs(round);
+  hCandKpi = accuKpi.GetResults();
+  hCandKpiCuts = accuKpiCuts.GetResults();
+  hCandK3pi = accuK3pi.GetResults();
+  hCandK3piCuts = accuK3piCuts.GetResults();
+  if (opts.cutScan) {
+    scanKpi = scanAccuKpi->GetResults("KpiCutScan");
+    scanK3pi = scanAccuK3pi->GetResults("K3piCutScan");
+  }
+
+  // Round 2: the best candidate plotters, and all the MC histograms
+  rankerKpi.Finalize();
+  rankerK3pi.Finalize();
+  auto dfRankedKpi = DefineRanks(dfCutKpi, rankerKpi);
+  auto dfRankedK3pi = DefineRanks(dfCutK3pi, rankerK3pi);
+  plottersKpiBC = BookBestCandidates<KpiChannel>(dfRankedKpi, dfDefMCKpi, rankerKpi, canvasBC, "Kpi", "K#pi",
+                                                 opts.autoRange);
+  plottersK3piBC = BookBestCandidates<K3piChannel>(dfRankedK3pi, dfDefMCK3pi, rankerK3pi, canvasBC,
+                                                   "K3pi", "K3#pi", opts.autoRange);
+  for (auto plt : GetPlotters()) // The best candidate ones are new
+    plt->SetPurityReserve(opts.purityReserve);
+  if (!opts.exportDir.IsNull())
+    BookExports(dfRankedKpi, dfRankedK3pi);
+  ROOT::RDF::RunGraphs({dfKpi.Count(), dfK3pi.Count(), dfMCKpi.Count(), dfMCK3pi.Count()});
+}
+
+void Analysis::BookExports(SigBkgPlotter::FilterDF& dfRankedKpi, SigBkgPlotter::FilterDF& dfRankedK3pi)
+{
+  exportKpi = make_unique<NpyExporter>(opts.exportDir + "/Kpi", exportFeatures<KpiChannel>());
+  exportK3pi = make_unique<NpyExporter>(opts.exportDir + "/K3pi", exportFeatures<K3piChannel>());
+  sideLoops.push_back(BookExport(dfRankedKpi, *exportKpi));
+  sideLoops.push_back(BookExport(dfRankedK3pi, *exportK3pi));
+}
+
+void Analysis::Save(TDirectory* dir)
+{
+  for (auto plt : GetPlotters())
+    for (TH1* h : plt->GetAllHistos())
+      dir->WriteTObject(h);
+  for (auto cf : {&cutFlowKpi, &cutFlowK3pi})
+    for (TH1* h : cf->GetAllHistos())
+      dir->WriteTObject(h);
+  for (auto cand : {&hCandKpi, &hCandKpiCuts, &hCandK3pi, &hCandK3piCuts}) {
+    TH2D* h = get<0>(*cand);
+    dir->WriteTObject(h);
+    TParameter<Long64_t> nSig(h->GetName() + "_nSig"TS, get<1>(*cand));
+    TParameter<Long64_t> nBkg(h->GetName() + "_nBkg"TS, get<2>(*cand));
+    dir->WriteTObject(&nSig);
+    dir->WriteTObject(&nBkg);
+  }
+  for (size_t i = 0; i < BCStrategies.size(); i++) {
+    TParameter<Long64_t> nSigKpi("nSigKpi" + BCStrategies[i].name, get<0>(bcKpi[i]));
+    TParameter<Long64_t> nBkgKpi("nBkgKpi" + BCStrategies[i].name, get<1>(bcKpi[i]));
+    TParameter<Long64_t> nSigK3pi("nSigK3pi" + BCStrategies[i].name, get<0>(bcK3pi[i]));
+    TParameter<Long64_t> nBkgK3pi("nBkgK3pi" + BCStrategies[i].name, get<1>(bcK3pi[i]));
+    for (auto p : {&nSigKpi, &nBkgKpi, &nSigK3pi, &nBkgK3pi})
+      dir->WriteTObject(p);
+  }
+  if (opts.cutScan)
+    for (auto h : {get<0>(scanKpi), get<1>(scanKpi), get<0>(scanK3pi), get<1>(scanK3pi)})
+      dir->WriteTObject(h);
+  if (opts.truthJoin)
+    for (auto join : {&joinKpi, &joinK3pi})
+      for (TH1D* h : join->All())
+        dir->WriteTObject(h);
+  for (auto h : resMaps)
+    dir->WriteTObject(h);
+  if (opts.variations)
+    for (auto vs : {variationsKpi.get(), variationsK3pi.get()})
+      for (TH1* h : vs->GetAllHistos())
+        dir->WriteTObject(h);
+  TParameter<Long64_t> pMCKpi("nMCKpi", nMCKpi), pMCK3pi("nMCK3pi", nMCK3pi);
+  dir->WriteTObject(&pMCKpi);
+  dir->WriteTObject(&pMCK3pi);
+}
+
+void Analysis::Merge(TDirectory* dir)
+{
+  auto getCount = [dir](TString name) {
+    auto p = dir->Get<TParameter<Long64_t>>(name);
+    CHECKA(p, name);
+    return p->GetVal();
+  };
+
+  auto mergeHistos = [dir](const vector<TH1*>& histos) {
+    for (TH1* h : histos) {
+      TH1* hp = dir->Get<TH1>(h->GetName());
+      CHECKA(hp, h->GetName());
+      h->Add(hp);
+    }
+  };
+
+  for (auto plt : GetPlotters())
+    mergeHistos(plt->GetAllHistos());
+  for (auto cf : {&cutFlowKpi, &cutFlowK3pi})
+    mergeHistos(cf->GetAllHistos());
+  for (auto cand : {&hCandKpi, &hCandKpiCuts, &hCandK3pi, &hCandK3piCuts}) {
+    TH2D* h = get<0>(*cand);
+    TH2D* hp = dir->Get<TH2D>(h->GetName());
+    CHECKA(hp, h->GetName());
+    h->Add(hp);
+    get<1>(*cand) += getCount(h->GetName() + "_nSig"TS);
+    get<2>(*cand) += getCount(h->GetName() + "_nBkg"TS);
+  }
+  for (size_t i = 0; i < BCStrategies.size(); i++) {
+    get<0>(bcKpi[i]) += getCount("nSigKpi" + BCStrategies[i].name);
+    get<1>(bcKpi[i]) += getCount("nBkgKpi" + BCStrategies[i].name);
+    get<0>(bcK3pi[i]) += getCount("nSigK3pi" + BCStrategies[i].name);
+    get<1>(bcK3pi[i]) += getCount("nBkgK3pi" + BCStrategies[i].name);
+  }
+  if (opts.cutScan) {
+    for (auto h : {get<0>(scanKpi), get<1>(scanKpi), get<0>(scanK3pi), get<1>(scanK3pi)}) {
+      THnD* hp = dir->Get<THnD>(h->GetName());
+      CHECKA(hp, h->GetName());
+      h->Add(hp);
+    }
+  }
+  if (opts.truthJoin)
+    for (auto join : {&joinKpi, &joinK3pi})
+      for (TH1D* h : join->All())
+        mergeHistos({h});
+  for (auto h : resMaps) {
+    THnSparseD* hp = dir->Get<THnSparseD>(h->GetName());
+    CHECKA(hp, h->GetName());
+    h->Add(hp);
+  }
+  if (opts.variations)
+    for (auto vs : {variationsKpi.get(), variationsK3pi.get()})
+      mergeHistos(vs->GetAllHistos());
+  nMCKpi += getCount("nMCKpi");
+  nMCK3pi += getCount("nMCK3pi");
+}
+
+void Analysis::Print(PDFCanvas& canvasCand, TFile& outRootFile)
+{
+  // The first strategy is the reference one for the tables
+  auto bcTuple = [](const tuple<UInt_t,UInt_t>& bc) {
+    return make_tuple((TH2D*)nullptr, get<0>(bc), get<1>(bc));
+  };
+  vector<tuple<UInt_t,UInt_t>> bcTotal;
+  for (size_t i = 0; i < BCStrategies.size(); i++)
+    bcTotal.push_back(make_tuple(get<0>(bcKpi[i]) + get<0>(bcK3pi[i]), get<1>(bcKpi[i]) + get<1>(bcK3pi[i])));
 
   cout << "Processing Kpi..." << endl;
-  auto nMCKpi = dfMCKpi.Count();
-  auto hCandKpi = CutEfficiencyAnalysis(dfDefKpi);
-  auto hCandKpiCuts = CutEfficiencyAnalysis(dfCutKpi);
-  auto hCandKpiBC = CutEfficiencyAnalysis(dfBCKpi);
-  DoCandAna(hCandKpi, hCandKpiCuts, hCandKpiBC, *nMCKpi, canvasCand, "K#pi");
+  DoCandAna(hCandKpi, hCandKpiCuts, bcTuple(bcKpi.front()), nMCKpi, canvasCand, "K#pi");
+  DoBCComparison(BCStrategies, bcKpi, get<1>(hCandKpiCuts), nMCKpi);
 
   cout << "Processing K3pi..." << endl;
-  auto nMCK3pi = dfMCK3pi.Count();
-  auto hCandK3pi = CutEfficiencyAnalysis(dfDefK3pi);
-  auto hCandK3piCuts = CutEfficiencyAnalysis(dfCutK3pi);
-  auto hCandK3piBC = CutEfficiencyAnalysis(dfBCK3pi);
-  DoCandAna(hCandK3pi, hCandK3piCuts, hCandK3piBC, *nMCK3pi, canvasCand, "K3#pi");
+  DoCandAna(hCandK3pi, hCandK3piCuts, bcTuple(bcK3pi.front()), nMCK3pi, canvasCand, "K3#pi");
+  DoBCComparison(BCStrategies, bcK3pi, get<1>(hCandK3piCuts), nMCK3pi);
 
   cout << "Total" << endl;
   DoCandAna(
     make_tuple(nullptr, get<1>(hCandKpi) + get<1>(hCandK3pi), get<2>(hCandKpi) + get<2>(hCandK3pi)),
     make_tuple(nullptr, get<1>(hCandKpiCuts) + get<1>(hCandK3piCuts), get<2>(hCandKpiCuts) + get<2>(hCandK3piCuts)),
-    make_tuple(nullptr, get<1>(hCandKpiBC) + get<1>(hCandK3piBC), get<2>(hCandKpiBC) + get<2>(hCandK3piBC)),
-    *nMCKpi + *nMCK3pi, canvasCand, "");
+    bcTuple(bcTotal.front()), nMCKpi + nMCK3pi, canvasCand, "");
+  DoBCComparison(BCStrategies, bcTotal, get<1>(hCandKpiCuts) + get<1>(hCandK3piCuts), nMCKpi + nMCK3pi);
 
   // Factors determined empirically, use 1 (or comment lines) for auto
-  plotterKpi.SetBkgDownScaleFactor(1);
-  plotterKpiCuts.SetBkgDownScaleFactor(1);
-  plotterKpiBC.SetBkgDownScaleFactor(1);
-  plotterK3pi.SetBkgDownScaleFactor(1);
-  plotterK3piCuts.SetBkgDownScaleFactor(1);
-  plotterK3piBC.SetBkgDownScaleFactor(1);
+  for (auto plt : GetPlotters())
+    plt->SetBkgDownScaleFactor(1);
 
-  TFile outRootFile(outFileName + "_efficiency.root", "recreate");
+  // All the fits at once, on all the cores
+  FitScheduler fits;
+  scheduleFits<KpiChannel>(plotterKpi, fits);
+  scheduleFits<K3piChannel>(plotterK3pi, fits);
+  scheduleFits<KpiChannel>(plotterKpiCuts, fits);
+  scheduleFits<K3piChannel>(plotterK3piCuts, fits);
+  for (const auto& plt : plottersKpiBC)
+    scheduleFits<KpiChannel>(*plt, fits);
+  for (const auto& plt : plottersK3piBC)
+    scheduleFits<K3piChannel>(*plt, fits);
+  if (opts.variations) {
+    for (auto plt : variationsKpi->GetPlotters())
+      scheduleFits<KpiChannel>(*plt, fits);
+    for (auto plt : variationsK3pi->GetPlotters())
+      scheduleFits<K3piChannel>(*plt, fits);
+  }
+  fits.RunAll(NThreads);
+  fits.Write(outRootFile.mkdir("Fits", "Fits", true));
+
+  // From here on, the results are written to outRootFile by the writer's
+  // thread while the plots are drawn: the temporary objects stay out of it
+  gROOT->cd();
+  ResultWriter writer(outRootFile);
+
+  writer.cd("Kpi");
+  DoPlot<KpiChannel>(plotterKpi, fits, opts.adaptiveBins);
+  writer.cd("K3pi");
+  DoPlot<K3piChannel>(plotterK3pi, fits, opts.adaptiveBins);
+  writer.cd("KpiCuts");
+  DoPlot<KpiChannel>(plotterKpiCuts, fits, opts.adaptiveBins);
+  writer.cd("K3piCuts");
+  DoPlot<K3piChannel>(plotterK3piCuts, fits, opts.adaptiveBins);
+  writer.cd("KpiCutFlow");
+  cutFlowKpi.Print(nMCKpi);
+  writer.cd("K3piCutFlow");
+  cutFlowK3pi.Print(nMCK3pi);
+  for (const auto& plt : plottersKpiBC) {
+    writer.cd(plt->GetNamePrefix());
+    DoPlot<KpiChannel>(*plt, fits);
+  }
+  for (const auto& plt : plottersK3piBC) {
+    writer.cd(plt->GetNamePrefix());
+    DoPlot<K3piChannel>(*plt, fits);
+  }
+  if (opts.cutScan) {
+    writer.cd("KpiCutScan");
+    DoCutScan(scanKpi, KpiCutScanAxes, nMCKpi, "K#pi");
+    writer.cd("K3piCutScan");
+    DoCutScan(scanK3pi, K3piCutScanAxes, nMCK3pi, "K3#pi");
+  }
+  if (opts.variations) {
+    for (auto plt : variationsKpi->GetPlotters()) {
+      writer.cd(plt->GetNamePrefix());
+      DoPlot<KpiChannel>(*plt, fits);
+    }
+    for (auto plt : variationsK3pi->GetPlotters()) {
+      writer.cd(plt->GetNamePrefix());
+      DoPlot<K3piChannel>(*plt, fits);
+    }
+    writer.cd("KpiVariations");
+    variationsKpi->Print(nMCKpi);
+    writer.cd("K3piVariations");
+    variationsK3pi->Print(nMCK3pi);
+  }
+  if (opts.truthJoin) {
+    writer.cd("KpiTruthJoin");
+    DoTruthJoin(joinKpi, "K#pi");
+    writer.cd("K3piTruthJoin");
+    DoTruthJoin(joinK3pi, "K3#pi");
+  }
+  if (opts.resolutionMaps) {
+    writer.cd("ResolutionMaps");
+    for (auto h : resMaps) {
+      Long64_t nDense = 1;
+      for (int i = 0; i < h->GetNdimensions(); i++)
+        nDense *= h->GetAxis(i)->GetNbins() + 2;
+      cout << TString::Format("%s: %lld filled bins (%.2g%% of %lld)", h->GetName(), h->GetNbins(),
+                              100.0 * h->GetNbins() / nDense, nDense) << endl;
+      WriteResult(h);
+      THnSparseD* hSigma = SigmaMap(h, h->GetName() + "_sigma68"TS);
+      WriteResult(hSigma);
+      delete hSigma;
+    }
+  }
+  writer.Close();
+}
+
+/** Books the analysis of files and prints its estimated memory. With
+ * opts.memBudget, if the estimate is over the budget, the analysis is booked
+ * again with a cheaper configuration (see PlanMemory): the purity event
+ * lists are only reserved for their expected entries, then the number of
+ * slots is reduced.
+ */
+unique_ptr<Analysis> BookAnalysis(const vector<string>& files, PDFCanvas& canvas, PDFCanvas& canvasCuts,
+                                  PDFCanvas& canvasBC, AnalysisOptions opts)
+{
+  auto ana = make_unique<Analysis>(files, canvas, canvasCuts, canvasBC, opts);
+  auto footprints = ana->GetFootprints();
+  if (opts.memBudget > 0) {
+    Footprint total;
+    for (const auto& nfp : footprints)
+      total += nfp.second;
+    const unsigned int nSlots = GetThreadPoolSize();
+    const MemoryPlan plan = PlanMemory(total, opts.memBudget, nSlots, opts.purityReserve);
+    opts.purityReserve = plan.purityReserve;
+    if (plan.nSlots != nSlots) { // The slots are fixed when the dataframes are made
+      ana.reset();
+      ResetUniqueNames();
+      DisableImplicitMT();
+      EnableImplicitMT(plan.nSlots);
+      ana = make_unique<Analysis>(files, canvas, canvasCuts, canvasBC, opts);
+      footprints = ana->GetFootprints();
+    } else {
+      ana->opts = opts;
+      for (auto plt : ana->GetPlotters())
+        plt->SetPurityReserve(opts.purityReserve);
+    }
+  }
+  PrintFootprints(footprints, GetThreadPoolSize(), opts.purityReserve);
+  return ana;
+}
+
+/** Compiles the expressions that missed the JIT cache (if --jit-cache), after
+ * the outputs are written, and prints the summary.
+ */
+void PrintJitCache()
+{
+  TString summary = SaveJitCache();
+  if (!summary.IsNull())
+    cout << summary << endl;
+}
 
-  outRootFile.mkdir("Kpi", "Kpi", true)->cd();
-  DoPlot(plotterKpi, false);
-  outRootFile.mkdir("K3pi", "K3pi", true)->cd();
-  DoPlot(plotterK3pi, true);
-  outRootFile.mkdir("KpiCuts", "KpiCuts", true)->cd();
-  DoPlot(plotterKpiCuts, false);
-  outRootFile.mkdir("K3piCuts", "K3piCuts", true)->cd();
-  DoPlot(plotterK3piCuts, true);
-  outRootFile.mkdir("KpiBC", "KpiBC", true)->cd();
-  DoPlot(plotterKpiBC, false);
-  outRootFile.mkdir("K3piBC", "K3piBC", true)->cd();
-  DoPlot(plotterK3piBC, true);
+/** Processes the files in inDir that are not in the store yet, then
+ * merges them with the stored ones and refreshes all the outputs.
+ */
+void ProcessNewFiles(ResultsStore& store, TString inDir, const vector<TString>& files,
+                     const vector<TString>& newFiles, AnalysisOptions opts)
+{
+  PDFCanvas canvas(inDir + ".pdf", "c");
+  PDFCanvas canvasCuts(inDir + "_offline_cuts.pdf", "cc");
+  PDFCanvas canvasBC(inDir + "_best_candidate.pdf", "ccb");
+  PDFCanvas canvasCand(inDir + "_candidates.pdf", "ccc");
+
+  unique_ptr<Analysis> ana;
+  for (const TString& file : newFiles) {
+    cout << "Reading " << file << endl;
+    ana.reset();
+    ResetUniqueNames(); // Same names in all the partial results
+    ana = BookAnalysis({file.Data()}, canvas, canvasCuts, canvasBC, opts);
+    ana->Run();
+    store.Save(file, [&ana](TDirectory* dir) { ana->Save(dir); });
+  }
+
+  // The last analysis has been run on the last file, add all the others
+  store.ForEachPartial(files, [&ana](TDirectory* dir) { ana->Merge(dir); }, newFiles.back());
+
+  TFile outRootFile(inDir + "_efficiency.root", "recreate");
+  ana->Print(canvasCand, outRootFile);
+}
+
+int main(int argc, char* argv[])
+{
+  ArgParser parser("Analysis program for B0 -> [D* -> [D0 -> K pi (pi pi)] pi] mu nu.\n"
+                   "The input is a ntuple file or, with --incremental or --watch, a directory\n"
+                   "of ntuple files, of which only the new ones are processed each time.\n"
+                   "With --serve SOCKET, the ntuple is cached in memory and histograms are\n"
+                   "booked on request from the Unix socket SOCKET (see the README).");
+  parser.AddPositionalArg("input");
+  parser.AddFlag("incremental");
+  parser.AddFlag("watch");
+  parser.AddFlag("cut-scan");
+  parser.AddFlag("adaptive-bins");
+  parser.AddFlag("truth-join");
+  parser.AddFlag("variations");
+  parser.AddOption("serve");
+  parser.AddOption("mem-budget");
+  parser.AddOption("fraction");
+  parser.AddOption("target-precision");
+  parser.AddOption("read-ahead");
+  parser.AddFlag("prefetch");
+  parser.AddFlag("io-stats");
+  parser.AddFlag("concurrent-loops");
+  parser.AddFlag("resolution-maps");
+  parser.AddOption("export");
+  parser.AddFlag("cut-order");
+  parser.AddOption("jit-cache");
+  parser.AddFlag("auto-range");
+  auto args = parser.ParseArgs(argc, argv);
+
+  AnalysisOptions opts;
+  opts.cutScan = args.count("cut-scan");
+  opts.adaptiveBins = args.count("adaptive-bins");
+  opts.truthJoin = args.count("truth-join");
+  opts.variations = args.count("variations");
+  opts.ioStats = args.count("io-stats");
+  opts.concurrentLoops = args.count("concurrent-loops");
+  opts.resolutionMaps = args.count("resolution-maps");
+  if (args.count("export"))
+    opts.exportDir = args["export"];
+  opts.cutOrder = args.count("cut-order");
+  opts.autoRange = args.count("auto-range");
+  double readAhead = ReadAheadClusters;
+  if (args.count("read-ahead")) {
+    readAhead = args["read-ahead"].Atof();
+    if (!args["read-ahead"].IsFloat() || readAhead <= 0) {
+      cout << "Invalid read-ahead (expected a number of clusters)." << endl;
+      return 1;
+    }
+  }
+  if (args.count("mem-budget")) {
+    if (!args["mem-budget"].IsDigit()) {
+      cout << "Invalid memory budget (expected MB)." << endl;
+      return 1;
+    }
+    opts.memBudget = args["mem-budget"].Atoll() * 1048576ull;
+  }
+  if (args.count("fraction")) {
+    opts.fraction = args["fraction"].Atof();
+    if (!args["fraction"].IsFloat() || opts.fraction <= 0 || opts.fraction > 1) {
+      cout << "Invalid fraction (expected 0 < fraction <= 1)." << endl;
+      return 1;
+    }
+  }
+  double targetPrecision = 0;
+  if (args.count("target-precision")) {
+    targetPrecision = args["target-precision"].Atof();
+    if (!args["target-precision"].IsFloat() || targetPrecision <= 0) {
+      cout << "Invalid target precision (expected a relative precision, e.g. 0.05)." << endl;
+      return 1;
+    }
+    if (!args.count("fraction"))
+      opts.fraction = PreviewStartFraction;
+  }
+
+  EnableImplicitMT(NThreads);
+  ConfigureInput(readAhead, args.count("prefetch"));
+  gStyle->SetOptStat(0); // TODO If more style lines appear, make a function
+
+  const bool watch = args.count("watch");
+  if (args.count("serve") && (watch || args.count("incremental"))) {
+    cout << "--serve takes a single ntuple file." << endl;
+    return 1;
+  }
+  const bool preview = opts.fraction < 1 || targetPrecision > 0;
+  if (preview && (watch || args.count("incremental") || args.count("serve"))) {
+    cout << "--fraction and --target-precision only work on a single ntuple file." << endl;
+    return 1;
+  }
+  if (targetPrecision > 0 && (opts.truthJoin || args.count("export") || opts.autoRange)) {
+    cout << "--target-precision does not work with --truth-join, --export and --auto-range (the passes could not"
+            " be added)." << endl;
+    return 1;
+  }
+  if (args.count("export") && (watch || args.count("incremental") || args.count("serve"))) {
+    cout << "--export only works on a single ntuple file." << endl;
+    return 1;
+  }
+  if (opts.autoRange && (watch || args.count("incremental") || args.count("serve"))) {
+    cout << "--auto-range only works on a single ntuple file (the partial results would not have the same bins)."
+         << endl;
+    return 1;
+  }
+  if (args.count("jit-cache")) {
+    if (args.count("serve")) {
+      cout << "--jit-cache does not work with --serve (the requests are jitted)." << endl;
+      return 1;
+    }
+    OpenJitCache(args["jit-cache"]);
+  }
+  if (watch || args.count("incremental")) {
+    TString inDir = args["input"];
+    while (inDir.EndsWith("/") && inDir.Length() > 1)
+      inDir.Remove(inDir.Length() - 1);
+    if (!gSystem->IsAbsoluteFileName(inDir))
+      inDir = TString(gSystem->WorkingDirectory()) + "/" + inDir;
+    ResultsStore store(inDir + "_store", ResultsKey(opts));
+    while (true) {
+      auto files = ResultsStore::ListRootFiles(inDir, watch ? WatchSettleTime : 0);
+      auto newFiles = store.GetNewFiles(files);
+      if (newFiles.empty()) {
+        cout << "No new files in " << inDir << endl;
+      } else {
+        ProcessNewFiles(store, inDir, files, newFiles, opts);
+        PrintJitCache();
+      }
+      if (!watch) return 0;
+      gSystem->Sleep(WatchInterval * 1000);
+    }
+  }
+
+  TString inFileName = args["input"];
+  if (!inFileName.EndsWith(".root")) {
+    cout << "Invalid input file (expected to end with \".root\")." << endl;
+    return 1;
+  }
+
+  if (args.count("serve")) {
+    AnaServer server({inFileName.Data()}, [](SigBkgPlotter::DefineDF df, TString treeName) {
+      if (treeName.EndsWith("K3pi"))
+        return treeName.BeginsWith("MC") ? defineMCVariables<K3piChannel>(df) : defineVariables<K3piChannel>(df);
+      return treeName.BeginsWith("MC") ? defineMCVariables<KpiChannel>(df) : defineVariables<KpiChannel>(df);
+    });
+    server.Run(args["serve"]);
+    return 0;
+  }
+
+  // The previews do not overwrite the full outputs
+  TString outFileName = inFileName(0, inFileName.Length() - 5) + (preview ? "_preview" : "");
+  TString outFileNameCuts = outFileName + "_offline_cuts";
+  TString outFileNameBC = outFileName + "_best_candidate";
+
+  PDFCanvas canvas(outFileName + ".pdf", "c"); // Default size is fine (I wrote it!)
+  PDFCanvas canvasCuts(outFileNameCuts + ".pdf", "cc");
+  PDFCanvas canvasBC(outFileNameBC + ".pdf", "ccb");
+  PDFCanvas canvasCand(outFileName + "_candidates.pdf", "ccc");
+
+  // With --target-precision, each pass only processes the next slice of the
+  // events and adds the results of the previous ones (as --incremental)
+  unique_ptr<Analysis> ana;
+  unique_ptr<TMemFile> previous; // Results of the events in [0, opts.fractionLow)
+  while (true) {
+    if (opts.fraction < 1 || opts.fractionLow > 0)
+      cout << TString::Format("Sampling %.3g%% of the events (%.3g%% in total)",
+                              100 * (opts.fraction - opts.fractionLow), 100 * opts.fraction) << endl;
+    ana.reset();
+    ResetUniqueNames(); // Same names in all the passes
+    ana = BookAnalysis({inFileName.Data()}, canvas, canvasCuts, canvasBC, opts);
+    ana->Run();
+    if (previous)
+      ana->Merge(previous.get());
+    if (targetPrecision <= 0 || opts.fraction >= 1) break;
+    const double precision = ana->GetPrecision();
+    if (precision <= targetPrecision) break;
+    // Not left as gDirectory: the histograms of the next pass must not be
+    // attached to it (Merge would find them instead of the saved ones)
+    TDirectory::TContext noDir(nullptr);
+    auto results = make_unique<TMemFile>("previewResults", "recreate");
+    ana->Save(results.get());
+    previous = move(results);
+    // Aim a bit beyond the target, and at least double (the loops have a fixed cost)
+    opts.fractionLow = opts.fraction;
+    opts.fraction = min(1.0, opts.fraction * max(2.0, 1.2 * TMath::Sq(precision / targetPrecision)));
+  }
+
+  TFile outRootFile(outFileName + "_efficiency.root", "recreate");
+  ana->Print(canvasCand, outRootFile);
+  PrintJitCache();
 }